@@ -152,6 +152,104 @@ module sremOp(input [WIDTH - 1 : 0] in0, input [WIDTH - 1 : 0] in1, output [WIDT
    assign out = $signed(in0) % $signed(in1);
 endmodule
 
+module xorOp(input [WIDTH - 1:0]  in0, input [WIDTH - 1:0] in1, output [WIDTH - 1:0] out);
+   parameter WIDTH = 1;
+   
+   assign out = in0 ^ in1;
+endmodule
+
+module sge(input [WIDTH - 1:0]  in0, input [WIDTH - 1:0] in1, output [0:0] out);
+   parameter WIDTH = 1;
+   
+   assign out = $signed(in0) >= $signed(in1);
+endmodule
+
+module sle(input [WIDTH - 1:0]  in0, input [WIDTH - 1:0] in1, output [0:0] out);
+   parameter WIDTH = 1;
+   
+   assign out = $signed(in0) <= $signed(in1);
+endmodule
+
+module ugt(input [WIDTH - 1:0]  in0, input [WIDTH - 1:0] in1, output [0:0] out);
+   parameter WIDTH = 1;
+   
+   assign out = $unsigned(in0) > $unsigned(in1);
+endmodule
+
+module uge(input [WIDTH - 1:0]  in0, input [WIDTH - 1:0] in1, output [0:0] out);
+   parameter WIDTH = 1;
+   
+   assign out = $unsigned(in0) >= $unsigned(in1);
+endmodule
+
+module ule(input [WIDTH - 1:0]  in0, input [WIDTH - 1:0] in1, output [0:0] out);
+   parameter WIDTH = 1;
+   
+   assign out = $unsigned(in0) <= $unsigned(in1);
+endmodule
+
+// Delays in by LATENCY cycles
+module pipeline_delay(input clk, input [WIDTH - 1 : 0] in, output [WIDTH - 1 : 0] out);
+   parameter WIDTH = 32;
+   parameter LATENCY = 1;
+
+   generate
+      if (LATENCY == 0) begin
+         assign out = in;
+      end else begin
+         reg [WIDTH - 1 : 0] stages [LATENCY - 1 : 0];
+         integer i;
+
+         always @(posedge clk) begin
+            stages[0] <= in;
+            for (i = 1; i < LATENCY; i = i + 1) begin
+               stages[i] <= stages[i - 1];
+            end
+         end
+
+         assign out = stages[LATENCY - 1];
+      end
+   endgenerate
+
+endmodule
+
+// Multicycle operators: the result of the inputs seen in cycle t is on out
+// in cycle t + LATENCY
+module mulPipe(input clk, input rst, input [WIDTH - 1:0]  in0, input [WIDTH - 1:0] in1, output [WIDTH - 1:0] out);
+   parameter WIDTH = 32;
+   parameter LATENCY = 2;
+
+   pipeline_delay #(.WIDTH(WIDTH), .LATENCY(LATENCY)) res(.clk(clk), .in(in0 * in1), .out(out));
+endmodule
+
+module sdivPipe(input clk, input rst, input [WIDTH - 1:0]  in0, input [WIDTH - 1:0] in1, output [WIDTH - 1:0] out);
+   parameter WIDTH = 32;
+   parameter LATENCY = 4;
+
+   pipeline_delay #(.WIDTH(WIDTH), .LATENCY(LATENCY)) res(.clk(clk), .in($signed(in0) / $signed(in1)), .out(out));
+endmodule
+
+module udivPipe(input clk, input rst, input [WIDTH - 1:0]  in0, input [WIDTH - 1:0] in1, output [WIDTH - 1:0] out);
+   parameter WIDTH = 32;
+   parameter LATENCY = 4;
+
+   pipeline_delay #(.WIDTH(WIDTH), .LATENCY(LATENCY)) res(.clk(clk), .in($unsigned(in0) / $unsigned(in1)), .out(out));
+endmodule
+
+module sremPipe(input clk, input rst, input [WIDTH - 1:0]  in0, input [WIDTH - 1:0] in1, output [WIDTH - 1:0] out);
+   parameter WIDTH = 32;
+   parameter LATENCY = 4;
+
+   pipeline_delay #(.WIDTH(WIDTH), .LATENCY(LATENCY)) res(.clk(clk), .in($signed(in0) % $signed(in1)), .out(out));
+endmodule
+
+module uremPipe(input clk, input rst, input [WIDTH - 1:0]  in0, input [WIDTH - 1:0] in1, output [WIDTH - 1:0] out);
+   parameter WIDTH = 32;
+   parameter LATENCY = 4;
+
+   pipeline_delay #(.WIDTH(WIDTH), .LATENCY(LATENCY)) res(.clk(clk), .in($unsigned(in0) % $unsigned(in1)), .out(out));
+endmodule
+
 module sliceOp(input [IN_WIDTH - 1 : 0] in, output [OUT_WIDTH - 1 : 0] out);
    parameter IN_WIDTH = 32;
    parameter OUT_WIDTH = 32;
@@ -444,6 +542,161 @@ module axi_stall_manager(input clk,
    
 endmodule // axi_stall_manager
 
+// AXI4 master that reads a burst of read_len + 1 words starting at the
+// word address read_addr. Each beat is presented on read_data for one
+// cycle with valid high, and finished is high with the last beat.
+module axi_burst_read_handler(input clk,
+                              input                           rst,
+
+                              // User facing API
+                              input                           start_read,
+                              input [ADDR_WIDTH - 1 : 0]      read_addr,
+                              input [7 : 0]                   read_len,
+
+                              output reg [DATA_WIDTH - 1 : 0] read_data,
+                              output reg                      valid,
+                              output reg                      finished,
+
+                              // AXI facing API
+                              output reg                      m_axi_arvalid,
+                              input                           m_axi_arready,
+                              output reg [ADDR_WIDTH - 1 : 0] m_axi_araddr,
+                              output reg [7 : 0]              m_axi_arlen,
+                              output [2 : 0]                  m_axi_arsize,
+                              output [1 : 0]                  m_axi_arburst,
+
+                              input                           m_axi_rvalid,
+                              output                          m_axi_rready,
+                              input [DATA_WIDTH - 1 : 0]      m_axi_rdata,
+                              input [1 : 0]                   m_axi_rresp,
+                              input                           m_axi_rlast);
+
+   parameter DATA_WIDTH = 32;
+   parameter ADDR_WIDTH = 32;
+
+   reg                                busy;
+
+   // Incrementing bursts of full width beats
+   assign m_axi_arsize = $clog2(DATA_WIDTH / 8);
+   assign m_axi_arburst = 2'b01;
+   assign m_axi_rready = busy;
+
+   always @(posedge clk) begin
+      if (rst) begin
+         busy <= 0;
+         valid <= 0;
+         finished <= 0;
+         m_axi_arvalid <= 0;
+      end else begin
+         valid <= 0;
+         finished <= 0;
+
+         if (start_read) begin
+            busy <= 1;
+            m_axi_arvalid <= 1;
+            m_axi_araddr <= read_addr << $clog2(DATA_WIDTH / 8);
+            m_axi_arlen <= read_len;
+         end else if (m_axi_arready) begin
+            m_axi_arvalid <= 0;
+         end
+
+         if (busy && m_axi_rvalid) begin
+            read_data <= m_axi_rdata;
+            valid <= 1;
+
+            if (m_axi_rlast) begin
+               busy <= 0;
+               finished <= 1;
+            end
+         end
+      end
+   end
+
+endmodule // axi_burst_read_handler
+
+// AXI4 master that writes a burst of write_len + 1 words starting at the
+// word address write_addr. After start_write the user offers each beat on
+// write_data with write_data_valid high until write_data_ready is high.
+// finished is high the cycle after the write response arrives.
+module axi_burst_write_handler(input clk,
+                               input                           rst,
+
+                               // User facing API
+                               input                           start_write,
+                               input [ADDR_WIDTH - 1 : 0]      write_addr,
+                               input [7 : 0]                   write_len,
+
+                               input [DATA_WIDTH - 1 : 0]      write_data,
+                               input                           write_data_valid,
+                               output                          write_data_ready,
+
+                               output reg                      finished,
+
+                               // AXI facing API
+                               output reg                      m_axi_awvalid,
+                               input                           m_axi_awready,
+                               output reg [ADDR_WIDTH - 1 : 0] m_axi_awaddr,
+                               output reg [7 : 0]              m_axi_awlen,
+                               output [2 : 0]                  m_axi_awsize,
+                               output [1 : 0]                  m_axi_awburst,
+
+                               output                          m_axi_wvalid,
+                               input                           m_axi_wready,
+                               output [DATA_WIDTH - 1 : 0]     m_axi_wdata,
+                               output [STRB_WIDTH - 1 : 0]     m_axi_wstrb,
+                               output                          m_axi_wlast,
+
+                               input                           m_axi_bvalid,
+                               input [1 : 0]                   m_axi_bresp,
+                               output                          m_axi_bready);
+
+   parameter DATA_WIDTH = 32;
+   parameter ADDR_WIDTH = 32;
+   parameter STRB_WIDTH = (DATA_WIDTH/8);
+
+   reg [7 : 0]                         beats_left;
+
+   assign m_axi_awsize = $clog2(DATA_WIDTH / 8);
+   assign m_axi_awburst = 2'b01;
+
+   // Beats go straight through to the write data channel
+   assign m_axi_wvalid = write_data_valid;
+   assign m_axi_wdata = write_data;
+   assign m_axi_wstrb = {STRB_WIDTH{1'b1}};
+   assign m_axi_wlast = beats_left == 0;
+   assign write_data_ready = m_axi_wready;
+
+   assign m_axi_bready = 1'b1;
+
+   always @(posedge clk) begin
+      if (rst) begin
+         finished <= 0;
+         beats_left <= 0;
+         m_axi_awvalid <= 0;
+      end else begin
+         finished <= 0;
+
+         if (start_write) begin
+            m_axi_awvalid <= 1;
+            m_axi_awaddr <= write_addr << $clog2(DATA_WIDTH / 8);
+            m_axi_awlen <= write_len;
+            beats_left <= write_len;
+         end else if (m_axi_awready) begin
+            m_axi_awvalid <= 0;
+         end
+
+         if (m_axi_wvalid && m_axi_wready && beats_left != 0) begin
+            beats_left <= beats_left - 1;
+         end
+
+         if (m_axi_bvalid) begin
+            finished <= 1;
+         end
+      end
+   end
+
+endmodule // axi_burst_write_handler
+
 module register(input clk, input rst, input [WIDTH - 1:0] raddr, input [WIDTH - 1:0] waddr, input wen, input ren, input [WIDTH - 1:0] wdata, output [WIDTH - 1:0] rdata);
 
    parameter WIDTH = 32;
@@ -590,10 +843,8 @@ module fifo(input clk,
    //    $display("READ data is %d, at address 0", ram[0]);
    // end
 
-   always @(posedge clk) begin
-      `assert(read_ready && read_valid && write_ready && write_valid, 1'd0)      
-   end   
-
+   // A read and a write in the same cycle leave the fifo as full as it was,
+   // so dataflow stages can stream through it every cycle
    always @(posedge clk) begin
       if (!rst) begin
          if (read_valid) begin
@@ -602,7 +853,7 @@ module fifo(input clk,
             // Wraparound
             read_addr <= next_read_addr;
 
-            if (!empty && (next_read_addr == write_addr) && !write_valid) begin
+            if (!empty && (next_read_addr == write_addr) && !(write_valid && write_ready)) begin
 //               $display("FIFO empty: next_read_addr = %d, write_addr = %d", next_read_addr, write_addr);
                empty <= 1;
             end
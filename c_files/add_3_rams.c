@@ -0,0 +1,6 @@
+#include "ram.h"
+
+void add_3_rams(ram_32_128* a, ram_32_128* b, ram_32_128* c) {
+  write(c, 0, read(a, 0) + read(b, 0));
+  write(c, 1, read(a, 1) + read(b, 1));
+}
@@ -0,0 +1,10 @@
+#include "ram.h"
+
+// Built at -O0, where every local lives in an alloca that is stored to
+// and then loaded back
+void alloca_round_trip(ram_32_128* ram) {
+  int t = read(ram, 0);
+  t = t + 3;
+  int u = t + t;
+  write(ram, 1, u);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// AXI masters are structs named axi_<width>. Accesses are calls to
+// read_axi and write_axi, whose first argument is the master. Addresses
+// are word addresses. Accesses to consecutive words in the same block are
+// combined into bursts.
+typedef struct {
+  int data[1024];
+} axi_32;
+
+__attribute__((noinline, optnone))
+int read_axi(axi_32* bus, int addr) {
+  return bus->data[addr];
+}
+
+__attribute__((noinline, optnone))
+void write_axi(axi_32* bus, int addr, int data) {
+  bus->data[addr] = data;
+}
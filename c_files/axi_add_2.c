@@ -0,0 +1,8 @@
+#include "axi.h"
+
+void axi_add_2(axi_32* ddr) {
+#pragma unroll
+  for (int i = 0; i < 8; i++) {
+    write_axi(ddr, i + 8, read_axi(ddr, i) + 2);
+  }
+}
@@ -0,0 +1,23 @@
+#include "stream.h"
+
+// Stages are compiled to their own modules and run concurrently, passing
+// data through a fifo
+__attribute__((noinline))
+void add_1(stream_32* in, stream_32* out) {
+  for (int i = 0; i < 5; i++) {
+    write_stream(out, read_stream(in) + 1);
+  }
+}
+
+__attribute__((noinline))
+void times_2(stream_32* in, stream_32* out) {
+  for (int i = 0; i < 5; i++) {
+    write_stream(out, read_stream(in) * 2);
+  }
+}
+
+void dataflow_add(stream_32* in, stream_32* out) {
+  stream_32 mid;
+  add_1(in, &mid);
+  times_2(&mid, out);
+}
@@ -0,0 +1,39 @@
+#include "ram.h"
+
+// Uses the division, remainder, bitwise and shift operators and the
+// comparison predicates that the other kernels do not. The operands are
+// at 0, 1 and 2. Division and remainder take different operands, so
+// they are not combined into one operation.
+void int_ops(ram_32_128* ram) {
+  int a = read(ram, 0);
+  int b = read(ram, 1);
+  int c = read(ram, 2);
+  unsigned ua = a;
+  unsigned ub = b;
+  unsigned uc = c;
+
+  write(ram, 3, a / b);
+  write(ram, 4, a % c);
+  write(ram, 5, ua / ub);
+  write(ram, 6, ua % uc);
+  write(ram, 7, a ^ b);
+  write(ram, 8, a << b);
+  write(ram, 9, a >> b);
+  write(ram, 10, ua >> ub);
+
+  if (a >= b) {
+    write(ram, 11, 1);
+  }
+  if (b <= c) {
+    write(ram, 12, 1);
+  }
+  if (ua > uc) {
+    write(ram, 13, 1);
+  }
+  if (ub >= uc) {
+    write(ram, 14, 1);
+  }
+  if (uc <= ua) {
+    write(ram, 15, 1);
+  }
+}
@@ -0,0 +1,16 @@
+#include "ram.h"
+
+// The read of 1 can be issued before the write to 4, but the read of 4
+// has to wait for it, so that write is not posted. The write to 5 is
+// followed by work that does not touch it, so it is posted. The write to
+// 6 is followed by the return, so it is not.
+void posted_writes(ram_32_128* ram) {
+  int a = read(ram, 0);
+  write(ram, 4, a + 1);
+  int b = read(ram, 1);
+  int c = read(ram, 4);
+  write(ram, 5, b + c);
+  int d = read(ram, 2);
+  int e = read(ram, 3);
+  write(ram, 6, d + e);
+}
@@ -0,0 +1,8 @@
+#include "ram.h"
+
+void profiled_loop(ram_32_128* ram) {
+  int n = read(ram, 15);
+  for (int i = 0; i < n; i++) {
+    write(ram, i + 4, read(ram, i) + 2);
+  }
+}
@@ -0,0 +1,10 @@
+#include "ram.h"
+
+// Sum of a[i]*b[i], with a at 0 and b at 16, stored at 64
+void qor_dot_product(ram_32_128* ram) {
+  int sum = 0;
+  for (int i = 0; i < 16; i++) {
+    sum += read(ram, i) * read(ram, 16 + i);
+  }
+  write(ram, 64, sum);
+}
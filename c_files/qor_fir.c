@@ -0,0 +1,12 @@
+#include "ram.h"
+
+// 4 tap filter over x at 0 with coefficients at 48, y at 64
+void qor_fir(ram_32_128* ram) {
+  for (int i = 0; i < 16; i++) {
+    int acc = 0;
+    for (int k = 0; k < 4; k++) {
+      acc += read(ram, 48 + k) * read(ram, i + k);
+    }
+    write(ram, 64 + i, acc);
+  }
+}
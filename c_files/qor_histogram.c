@@ -0,0 +1,12 @@
+#include "ram.h"
+
+// Counts the low 3 bits of the 32 words at 0 into 8 bins at 64
+void qor_histogram(ram_32_128* ram) {
+  for (int b = 0; b < 8; b++) {
+    write(ram, 64 + b, 0);
+  }
+  for (int i = 0; i < 32; i++) {
+    int bin = 64 + (read(ram, i) & 7);
+    write(ram, bin, read(ram, bin) + 1);
+  }
+}
@@ -0,0 +1,14 @@
+#include "ram.h"
+
+// C = A * B for row major 4x4 matrices, with A at 0, B at 16 and C at 32
+void qor_matmul(ram_32_128* ram) {
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      int acc = 0;
+      for (int k = 0; k < 4; k++) {
+        acc += read(ram, 4*i + k) * read(ram, 16 + 4*k + j);
+      }
+      write(ram, 32 + 4*i + j, acc);
+    }
+  }
+}
@@ -0,0 +1,8 @@
+#include "ram.h"
+
+// Copies the 32 words at 0 to 64
+void qor_memcpy(ram_32_128* ram) {
+  for (int i = 0; i < 32; i++) {
+    write(ram, 64 + i, read(ram, i));
+  }
+}
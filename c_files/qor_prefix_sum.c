@@ -0,0 +1,10 @@
+#include "ram.h"
+
+// Running sums of the 16 words at 0, stored at 32
+void qor_prefix_sum(ram_32_128* ram) {
+  int sum = 0;
+  for (int i = 0; i < 16; i++) {
+    sum += read(ram, i);
+    write(ram, 32 + i, sum);
+  }
+}
@@ -0,0 +1,8 @@
+#include "ram.h"
+
+// c[i] = a[i] + b[i], with a at 0, b at 16 and c at 32
+void qor_vector_add(ram_32_128* ram) {
+  for (int i = 0; i < 16; i++) {
+    write(ram, 32 + i, read(ram, i) + read(ram, 16 + i));
+  }
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+// Memories are structs named ram_<width>_<depth>, or
+// ram_<width>_<depth>_<R>r_<W>w for R read and W write ports. Accesses are
+// calls to read and write, whose first argument is the memory.
 typedef struct {
   int data[128];
 } ram_32_128;
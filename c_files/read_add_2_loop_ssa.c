@@ -0,0 +1,10 @@
+#include "ram.h"
+
+void read_add_2_loop_ssa(ram_32_128* ram) {
+  // Trip count comes from memory so the loop is not fully unrolled. It is
+  // at most 31, which bounds the counter to 5 bits.
+  int n = read(ram, 15) & 31;
+  for (int i = 0; i < n; i++) {
+    write(ram, i + 4, read(ram, i) + 2);
+  }
+}
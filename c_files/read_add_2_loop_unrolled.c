@@ -0,0 +1,9 @@
+#include "ram.h"
+
+void read_add_2_loop_unrolled(ram_32_128* ram) {
+  // Trip count comes from memory, so unrolling needs a remainder loop
+  int n = read(ram, 15);
+  for (int i = 0; i < n; i++) {
+    write(ram, i + 4, read(ram, i) + 2);
+  }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// Streams are structs named stream_<width>. A stream argument is either
+// only read or only written, and connects to one side of a builtins.v
+// fifo. Accesses are calls to read_stream and write_stream, whose first
+// argument is the stream. They wait until the fifo is ready.
+typedef struct {
+  int data;
+} stream_32;
+
+__attribute__((noinline, optnone))
+int read_stream(stream_32* s) {
+  return s->data;
+}
+
+__attribute__((noinline, optnone))
+void write_stream(stream_32* s, int data) {
+  s->data = data;
+}
@@ -0,0 +1,8 @@
+#include "stream.h"
+
+void stream_add_2(stream_32* in, stream_32* out) {
+  int n = read_stream(in);
+  for (int i = 0; i < n; i++) {
+    write_stream(out, read_stream(in) + 2);
+  }
+}
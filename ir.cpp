@@ -1,6 +1,9 @@
 #include "ir.h"
 
+#include <climits>
 #include <fstream>
+#include <sstream>
+#include <tuple>
 
 using namespace CAC;
 
@@ -31,6 +34,14 @@ namespace CAC {
     return src->defaultValue(getName());
   }
 
+  static int ceilLog2(const int n) {
+    int bits = 0;
+    while ((1 << bits) < n) {
+      bits++;
+    }
+    return bits;
+  }
+
   Port dest(CC* assigner) {
     assert(assigner->isConnect());
     if (assigner->connection.first.isOutput()) {
@@ -52,17 +63,20 @@ namespace CAC {
   }
   
   CAC::Module* getWireMod(Context& c, const int width) {
-    string name = "wire" + to_string(width);
-    if (c.hasModule(name)) {
-      return c.getModule(name);
+    PrimitiveKey key(PRIMITIVE_KIND_WIRE, width, 0);
+    CAC::Module* cached = c.getPrimitive(key);
+    if (cached != nullptr) {
+      return cached;
     }
 
+    string name = "wire" + to_string(width);
     CAC::Module* w = c.addCombModule(name);
     w->setPrimitive(true);
     w->addInPort(width, "in");
     w->addOutPort(width, "out");
     w->setVerilogDeclString("mod_wire #(.WIDTH(" + to_string(width) + "))");
   
+    c.addPrimitive(key, w);
     return w;
   }
 
@@ -240,13 +254,11 @@ namespace CAC {
 
   std::string moduleDecl(Module* m) {
     string name = m->getName();
-    if (hasPrefix(name, "add")) {
-      return "add #(.WIDTH(16))";
-      //} else if (hasPrefix(name, "wire")) {
-      // return "mod_wire #(.WIDTH(16))";
-    } else {
-      return m->getVerilogDeclString();
+    if (!m->isPrimitiveModule() && m->getVerilogDeclString() == "") {
+      return name;
     }
+
+    return m->getVerilogDeclString();
   }
 
   bool isConstant(ModuleInstance* inst) {
@@ -273,17 +285,34 @@ namespace CAC {
     size_t pos = name.find(pattern);
     return name.substr(0, pos);
   }
+
+  // Name of the Verilog module a primitive is emitted as
+  std::string verilogModuleName(Module* m) {
+    return takeUntil(" ", moduleDecl(m));
+  }
+
+  int constantValue(ModuleInstance* inst) {
+    assert(isConstant(inst));
+    string rest = drop("const_", inst->source->getName());
+    return stoi(rest.substr(rest.find("_") + 1));
+  }
+
+  bool isConstantValue(Port pt, const int value) {
+    return isConstant(pt) && (constantValue(pt.inst) == value);
+  }
   
   string verilogConstString(ModuleInstance* inst) {
     assert(isConstant(inst));
-    string nm = inst->source->getName();
-    string rest = drop("const_", nm);
-    string width = takeUntil("_", rest);
-    reverse(rest);
-    string val = takeUntil("_", rest);
-    reverse(val);
+    string rest = drop("const_", inst->source->getName());
+    int width = stoi(takeUntil("_", rest));
 
-    return width + "'d" + val;
+    // Constants hold signed ints, so print the value's bits at the
+    // constant's width instead of a possibly negative decimal
+    uint64_t bits = (uint64_t) (int64_t) constantValue(inst);
+    if (width < 64) {
+      bits &= (((uint64_t) 1) << width) - 1;
+    }
+    return to_string(width) + "'d" + to_string(bits);
   }
  string verilogStringLastCycle(const Port pt, Module* m) {
     if (pt.inst != nullptr) {
@@ -437,8 +466,579 @@ namespace CAC {
   	return "if (!" + cond + ") begin $display(\"Assertion FAILED: " + cond + "\"); $finish(1); end";
   }
 
+  // Setters of a port are mutually exclusive (the controllers assert it), so
+  // at most one term of the OR is live in any cycle. If no setter fires the
+  // port gets its default value.
+  string parallelMuxString(const Port pt,
+                           const vector<pair<string, Port> >& conds,
+                           const std::string& defaultStr,
+                           Module* m) {
+    string w = to_string(pt.getWidth());
+    vector<string> terms;
+    vector<string> active;
+    for (auto c : conds) {
+      if (c.first == "") {
+        continue;
+      }
+      string sel = "{" + w + "{|" + parens(c.first) + "}}";
+      terms.push_back(parens(sel + " & " + parens(verilogString(c.second, m))));
+      active.push_back(parens(c.first));
+    }
+
+    if (defaultStr != "0") {
+      if (active.size() == 0) {
+        return defaultStr;
+      }
+      string noneActive = "!" + parens(stringList(" || ", active));
+      terms.push_back(parens("{" + w + "{" + noneActive + "}} & " + defaultStr));
+    }
+
+    if (terms.size() == 0) {
+      return "0";
+    }
+
+    return stringList(" | ", terms);
+  }
+
   void emitVerilog(Context& c, Module* m) {
-    ofstream out(m->getName() + ".v");
+    emitVerilog(c, m, VerilogEmitOptions());
+  }
+
+  std::string verilogFileName(Module* m, const VerilogEmitOptions& options) {
+    string fileName = m->getName() + ".v";
+    if (options.outputDir == "") {
+      return fileName;
+    }
+
+    if (options.outputDir.back() == '/') {
+      return options.outputDir + fileName;
+    }
+    return options.outputDir + "/" + fileName;
+  }
+
+  void emitVerilog(Context& c, Module* m, const VerilogEmitOptions& options) {
+    ofstream out(verilogFileName(m, options));
+    if (!out) {
+      cout << "Error: Could not open " << verilogFileName(m, options) << " for writing" << endl;
+      assert(false);
+    }
+    emitVerilog(c, m, out, options);
+    out.close();
+  }
+
+  std::string emitVerilogString(Context& c,
+                                Module* m,
+                                const VerilogEmitOptions& options) {
+    std::ostringstream out;
+    emitVerilog(c, m, out, options);
+    return out.str();
+  }
+
+  void emitModuleVerilog(Context& c,
+                         Module* m,
+                         std::ostream& out,
+                         const VerilogEmitOptions& options,
+                         const map<Module*, Module*>& replacements);
+
+  size_t hashCombine(size_t seed, const size_t v) {
+    return seed ^ (v + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+  }
+
+  size_t hashString(const std::string& str) {
+    return std::hash<std::string>()(str);
+  }
+
+  size_t hashSorted(vector<size_t> hashes) {
+    sort(begin(hashes), end(hashes));
+    size_t h = hashes.size();
+    for (auto v : hashes) {
+      h = hashCombine(h, v);
+    }
+    return h;
+  }
+
+  size_t ccContentHash(CC* instr) {
+    size_t h = hashCombine(instr->tp, instr->isStartAction);
+    if (instr->isConnect()) {
+      h = hashCombine(h, hashString(instr->connection.first.toString()));
+      h = hashCombine(h, hashString(instr->connection.second.toString()));
+    } else if (instr->isInvoke()) {
+      h = hashCombine(h, hashString(instr->invokedModule()->getName()));
+      for (auto b : instr->invokedBinding()) {
+        h = hashCombine(h, hashString(b.first));
+        h = hashCombine(h, hashString(b.second.toString()));
+      }
+    }
+    return h;
+  }
+
+  // Label of each CC that does not depend on where the CCs happen to be
+  // allocated. Labels are refined over successors until the number of
+  // distinct labels stops growing.
+  map<CC*, size_t> bodyLabels(Module* m) {
+    set<CC*> body = m->getBody();
+    map<CC*, size_t> label;
+    for (auto instr : body) {
+      label[instr] = ccContentHash(instr);
+    }
+
+    int numClasses = 0;
+    while (true) {
+      map<CC*, size_t> next;
+      set<size_t> classes;
+      for (auto instr : body) {
+        vector<size_t> succs;
+        for (auto act : instr->continuations) {
+          size_t a = hashString(act.condition.toString());
+          a = hashCombine(a, act.delay);
+          a = hashCombine(a, map_find(act.destination, label));
+          succs.push_back(a);
+        }
+        next[instr] = hashCombine(map_find(instr, label), hashSorted(succs));
+        classes.insert(next[instr]);
+      }
+
+      label = next;
+      if (((int) classes.size()) <= numClasses) {
+        break;
+      }
+      numClasses = classes.size();
+    }
+    return label;
+  }
+
+  size_t bodyHash(Module* m) {
+    vector<size_t> labels;
+    for (auto l : bodyLabels(m)) {
+      labels.push_back(l.second);
+    }
+    return hashSorted(labels);
+  }
+
+  size_t structuralHash(Module* m, map<Module*, size_t>& hashes) {
+    if (contains_key(m, hashes)) {
+      return map_find(m, hashes);
+    }
+
+    if (m->isPrimitiveModule()) {
+      size_t h = hashString(moduleDecl(m));
+      hashes[m] = h;
+      return h;
+    }
+
+    size_t h = 0;
+    for (auto pt : m->getInterfacePorts()) {
+      h = hashCombine(h, hashString(pt.getName()));
+      h = hashCombine(h, pt.getWidth());
+      h = hashCombine(h, pt.isInput);
+    }
+
+    for (auto d : m->getDefaultValues()) {
+      h = hashCombine(h, hashString(d.first));
+      h = hashCombine(h, d.second);
+    }
+
+    vector<size_t> resources;
+    for (auto r : m->getResources()) {
+      resources.push_back(hashCombine(hashString(r->getName()),
+                                      structuralHash(r->source, hashes)));
+    }
+    h = hashCombine(h, hashSorted(resources));
+
+    vector<size_t> scs;
+    for (auto sc : m->getStructuralConnections()) {
+      scs.push_back(hashCombine(hashString(sc.first.toString()),
+                                hashString(sc.second.toString())));
+    }
+    h = hashCombine(h, hashSorted(scs));
+    h = hashCombine(h, bodyHash(m));
+
+    hashes[m] = h;
+    return h;
+  }
+
+  bool sameCCContents(CC* a, CC* b) {
+    if (a->tp != b->tp || a->isStartAction != b->isStartAction) {
+      return false;
+    }
+
+    if (a->isConnect()) {
+      return a->connection.first.toString() == b->connection.first.toString() &&
+        a->connection.second.toString() == b->connection.second.toString();
+    }
+
+    if (a->isInvoke()) {
+      if (a->invokedModule()->getName() != b->invokedModule()->getName()) {
+        return false;
+      }
+
+      map<string, string> aBinding;
+      for (auto bnd : a->invokedBinding()) {
+        aBinding[bnd.first] = bnd.second.toString();
+      }
+      map<string, string> bBinding;
+      for (auto bnd : b->invokedBinding()) {
+        bBinding[bnd.first] = bnd.second.toString();
+      }
+      return aBinding == bBinding;
+    }
+
+    return true;
+  }
+
+  // Whether the continuations of a, read through the CC mapping, are the
+  // continuations of b. Destinations that are not mapped yet match
+  // anything.
+  bool sameContinuations(CC* a, CC* b, const map<CC*, CC*>& mapping, const bool complete) {
+    if (a->continuations.size() != b->continuations.size()) {
+      return false;
+    }
+
+    multiset<tuple<string, int, CC*> > aConts;
+    int unmapped = 0;
+    for (auto act : a->continuations) {
+      if (!contains_key(act.destination, mapping)) {
+        assert(!complete);
+        unmapped++;
+        continue;
+      }
+      aConts.insert(make_tuple(act.condition.toString(), act.delay, map_find(act.destination, mapping)));
+    }
+
+    for (auto act : b->continuations) {
+      auto it = aConts.find(make_tuple(act.condition.toString(), act.delay, act.destination));
+      if (it != aConts.end()) {
+        aConts.erase(it);
+      } else if (unmapped > 0) {
+        unmapped--;
+      } else {
+        return false;
+      }
+    }
+    return aConts.empty();
+  }
+
+  // Searches for a one to one mapping of the CCs of a onto those of b that
+  // keeps contents and continuations. Each CC is only tried against the CCs
+  // of b with the same label, so the search only backtracks among CCs that
+  // label refinement could not tell apart.
+  bool matchBodies(const vector<CC*>& aBody,
+                   const int i,
+                   const map<CC*, size_t>& aLabels,
+                   const map<size_t, vector<CC*> >& bByLabel,
+                   map<CC*, CC*>& mapping,
+                   set<CC*>& used) {
+    if (i == (int) aBody.size()) {
+      for (auto m : mapping) {
+        if (!sameContinuations(m.first, m.second, mapping, true)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    CC* a = aBody[i];
+    size_t label = map_find(a, aLabels);
+    if (!contains_key(label, bByLabel)) {
+      return false;
+    }
+
+    for (auto b : map_find(label, bByLabel)) {
+      if (elem(b, used) || !sameCCContents(a, b)) {
+        continue;
+      }
+
+      mapping[a] = b;
+      used.insert(b);
+      if (sameContinuations(a, b, mapping, false) &&
+          matchBodies(aBody, i + 1, aLabels, bByLabel, mapping, used)) {
+        return true;
+      }
+      mapping.erase(a);
+      used.erase(b);
+    }
+    return false;
+  }
+
+  bool sameBody(Module* a, Module* b) {
+    if (a->getBody().size() != b->getBody().size()) {
+      return false;
+    }
+
+    map<CC*, size_t> aLabels = bodyLabels(a);
+    map<size_t, vector<CC*> > bByLabel;
+    for (auto l : bodyLabels(b)) {
+      bByLabel[l.second].push_back(l.first);
+    }
+
+    vector<CC*> aBody;
+    for (auto l : aLabels) {
+      aBody.push_back(l.first);
+    }
+
+    map<CC*, CC*> mapping;
+    set<CC*> used;
+    return matchBodies(aBody, 0, aLabels, bByLabel, mapping, used);
+  }
+
+  // Whether a and b would be emitted the same apart from their names
+  bool structurallyEqual(Module* a, Module* b) {
+    if (a == b) {
+      return true;
+    }
+
+    if (a->isPrimitiveModule() || b->isPrimitiveModule()) {
+      return a->isPrimitiveModule() && b->isPrimitiveModule() &&
+        moduleDecl(a) == moduleDecl(b);
+    }
+
+    vector<Port> aPorts = a->getInterfacePorts();
+    vector<Port> bPorts = b->getInterfacePorts();
+    if (aPorts.size() != bPorts.size()) {
+      return false;
+    }
+    for (int i = 0; i < (int) aPorts.size(); i++) {
+      if (aPorts[i].getName() != bPorts[i].getName() ||
+          aPorts[i].getWidth() != bPorts[i].getWidth() ||
+          aPorts[i].isInput != bPorts[i].isInput) {
+        return false;
+      }
+    }
+
+    if (a->getDefaultValues() != b->getDefaultValues()) {
+      return false;
+    }
+
+    map<string, Module*> aResources;
+    for (auto r : a->getResources()) {
+      aResources[r->getName()] = r->source;
+    }
+    map<string, Module*> bResources;
+    for (auto r : b->getResources()) {
+      bResources[r->getName()] = r->source;
+    }
+    if (aResources.size() != bResources.size()) {
+      return false;
+    }
+    for (auto r : aResources) {
+      if (!contains_key(r.first, bResources) ||
+          !structurallyEqual(r.second, map_find(r.first, bResources))) {
+        return false;
+      }
+    }
+
+    multiset<pair<string, string> > aSCs;
+    for (auto sc : a->getStructuralConnections()) {
+      aSCs.insert({sc.first.toString(), sc.second.toString()});
+    }
+    multiset<pair<string, string> > bSCs;
+    for (auto sc : b->getStructuralConnections()) {
+      bSCs.insert({sc.first.toString(), sc.second.toString()});
+    }
+    if (aSCs != bSCs) {
+      return false;
+    }
+
+    return sameBody(a, b);
+  }
+
+  void collectHierarchy(Module* m, set<Module*>& visited, vector<Module*>& postOrder) {
+    if (elem(m, visited)) {
+      return;
+    }
+    visited.insert(m);
+
+    for (auto r : m->getResources()) {
+      if (!r->source->isPrimitiveModule()) {
+        collectHierarchy(r->source, visited, postOrder);
+      }
+    }
+    postOrder.push_back(m);
+  }
+
+  // Modules are listed children first. Modules that are structurally equal
+  // to an earlier one are left out and recorded in replacements. Hashes
+  // only pick which earlier modules to compare against.
+  vector<Module*> hierarchyToEmit(Module* top,
+                                  map<Module*, Module*>& replacements) {
+    set<Module*> visited;
+    vector<Module*> postOrder;
+    collectHierarchy(top, visited, postOrder);
+
+    map<Module*, size_t> hashes;
+    map<size_t, vector<Module*> > canonical;
+    vector<Module*> toEmit;
+    for (auto m : postOrder) {
+      size_t h = structuralHash(m, hashes);
+      Module* same = nullptr;
+      if (m != top) {
+        for (auto other : canonical[h]) {
+          if (structurallyEqual(m, other)) {
+            same = other;
+            break;
+          }
+        }
+      }
+
+      if (same != nullptr) {
+        replacements[m] = same;
+      } else {
+        canonical[h].push_back(m);
+        toEmit.push_back(m);
+      }
+    }
+    return toEmit;
+  }
+
+  // Instances are not wired to the debug ports of their modules, so only
+  // the top module gets profile counters
+  VerilogEmitOptions hierarchyOptions(Module* m,
+                                      Module* top,
+                                      const VerilogEmitOptions& options) {
+    VerilogEmitOptions mOptions = options;
+    mOptions.profileCounters = options.profileCounters && m == top;
+    return mOptions;
+  }
+
+  void emitVerilogHierarchy(Context& c,
+                            Module* top,
+                            std::ostream& out,
+                            const VerilogEmitOptions& options) {
+    map<Module*, Module*> replacements;
+    vector<Module*> toEmit = hierarchyToEmit(top, replacements);
+    for (auto m : toEmit) {
+      emitModuleVerilog(c, m, out, hierarchyOptions(m, top, options), replacements);
+      out << endl << endl;
+    }
+  }
+
+  void emitVerilogHierarchy(Context& c,
+                            Module* top,
+                            const VerilogEmitOptions& options) {
+    if (options.hierarchyInOneFile) {
+      ofstream out(verilogFileName(top, options));
+      if (!out) {
+        cout << "Error: Could not open " << verilogFileName(top, options) << " for writing" << endl;
+        assert(false);
+      }
+      emitVerilogHierarchy(c, top, out, options);
+      out.close();
+      return;
+    }
+
+    map<Module*, Module*> replacements;
+    vector<Module*> toEmit = hierarchyToEmit(top, replacements);
+    for (auto m : toEmit) {
+      ofstream out(verilogFileName(m, options));
+      if (!out) {
+        cout << "Error: Could not open " << verilogFileName(m, options) << " for writing" << endl;
+        assert(false);
+      }
+      emitModuleVerilog(c, m, out, hierarchyOptions(m, top, options), replacements);
+      out.close();
+    }
+  }
+
+  void emitVerilogHierarchy(Context& c, Module* top) {
+    emitVerilogHierarchy(c, top, VerilogEmitOptions());
+  }
+
+  void emitVerilog(Context& c,
+                   Module* m,
+                   std::ostream& out,
+                   const VerilogEmitOptions& options) {
+    emitModuleVerilog(c, m, out, options, {});
+  }
+
+  std::vector<std::string> profileCounterLabels(Module* m) {
+    set<string> labels;
+    for (auto instr : m->getBody()) {
+      if (instr->profileLabel != "") {
+        labels.insert(instr->profileLabel);
+      }
+    }
+
+    vector<string> addrs{"cycles"};
+    for (auto l : labels) {
+      addrs.push_back(l);
+    }
+    return addrs;
+  }
+
+  // The block being profiled changes in the cycle its start CC happens.
+  // Modules with start and done ports only count while they are running,
+  // and a new run leaves the previous run's last block
+  void emitProfileCounters(Module* m,
+                           std::ostream& out,
+                           const VerilogEmitOptions& options) {
+    vector<string> labels = profileCounterLabels(m);
+    int width = options.profileCounterWidth;
+    int addrWidth = max(1, ceilLog2(labels.size()));
+    string maxCount = "{" + to_string(width) + "{1'b1}}";
+
+    out << "\t// --- Profile counters" << endl;
+    for (int i = 0; i < (int) labels.size(); i++) {
+      out << "\t// Address " << i << ": " << labels[i] << endl;
+    }
+
+    out << "\treg [" << width - 1 << " : 0] profile_counters [" << labels.size() - 1 << " : 0];" << endl;
+    out << "\treg [" << addrWidth - 1 << " : 0] profile_block;" << endl;
+    out << "\treg [" << addrWidth - 1 << " : 0] profile_current;" << endl;
+    out << "\treg profile_running;" << endl;
+    out << "\twire profile_active;" << endl;
+    // The address port is rounded up to a power of two
+    out << "\tassign debug_counter_data = debug_counter_addr < " << labels.size() <<
+      " ? profile_counters[debug_counter_addr] : 0;" << endl;
+    if (m->hasPort("start") && m->hasPort("done")) {
+      out << "\tassign profile_active = start || (profile_running && !done);" << endl;
+    } else {
+      out << "\tassign profile_active = 1;" << endl;
+    }
+    out << endl;
+
+    out << "\talways @(*) begin" << endl;
+    if (m->hasPort("start")) {
+      out << "\t\tprofile_current = start ? 0 : profile_block;" << endl;
+    } else {
+      out << "\t\tprofile_current = profile_block;" << endl;
+    }
+    for (auto instr : m->getBody()) {
+      if (instr->profileLabel != "") {
+        int addr = distance(begin(labels), find(begin(labels), end(labels), instr->profileLabel));
+        out << "\t\tif (" << happenedVar(instr, m) << ") begin" << endl;
+        out << "\t\t\tprofile_current = " << addr << ";" << endl;
+        out << "\t\tend" << endl;
+      }
+    }
+    out << "\tend" << endl << endl;
+
+    out << "\talways @(posedge clk) begin" << endl;
+    out << "\t\tif (rst) begin" << endl;
+    out << "\t\t\tprofile_running <= 0;" << endl;
+    out << "\t\t\tprofile_block <= 0;" << endl;
+    for (int i = 0; i < (int) labels.size(); i++) {
+      out << "\t\t\tprofile_counters[" << i << "] <= 0;" << endl;
+    }
+    out << "\t\tend else begin" << endl;
+    out << "\t\t\tprofile_running <= profile_active;" << endl;
+    out << "\t\t\tprofile_block <= profile_current;" << endl;
+    out << "\t\t\tif (profile_active && profile_counters[0] != " << maxCount << ") begin" << endl;
+    out << "\t\t\t\tprofile_counters[0] <= profile_counters[0] + 1;" << endl;
+    out << "\t\t\tend" << endl;
+    out << "\t\t\tif (profile_active && profile_current != 0 && profile_counters[profile_current] != " << maxCount << ") begin" << endl;
+    out << "\t\t\t\tprofile_counters[profile_current] <= profile_counters[profile_current] + 1;" << endl;
+    out << "\t\t\tend" << endl;
+    out << "\t\tend" << endl;
+    out << "\tend" << endl << endl;
+  }
+
+  // replacements maps resource types that were deduplicated away to the
+  // module that is emitted in their place
+  void emitModuleVerilog(Context& c,
+                         Module* m,
+                         std::ostream& out,
+                         const VerilogEmitOptions& options,
+                         const map<Module*, Module*>& replacements) {
     out << "module " << m->getName() << "(" << endl;
 
     auto pts = m->getInterfacePorts();
@@ -447,7 +1047,7 @@ namespace CAC {
 
       printVerilog(out, reverseDir(pts[i]), m);
       
-      if (i < ((int) pts.size()) - 1) {
+      if (i < ((int) pts.size()) - 1 || options.profileCounters) {
         out << ", ";
       }
 
@@ -455,6 +1055,12 @@ namespace CAC {
       out << "\n";
     }
 
+    if (options.profileCounters) {
+      int addrWidth = max(1, ceilLog2(profileCounterLabels(m).size()));
+      out << "\tinput [" << addrWidth - 1 << " : 0] debug_counter_addr, " << endl;
+      out << "\toutput [" << options.profileCounterWidth - 1 << " : 0] debug_counter_data" << endl;
+    }
+
     out << "\t);" << endl;
 
     out << endl;
@@ -474,7 +1080,9 @@ namespace CAC {
             out << "\treg " << "[ " << pt.getWidth() - 1 << " : 0] " << verilogString(r->pt(pt.getName()), m) << ";" << endl;
           }
         }
-        out << "\t" << moduleDecl(r->source) + " " + r->getName() + "(";
+        Module* tp = contains_key(r->source, replacements) ?
+          map_find(r->source, replacements) : r->source;
+        out << "\t" << moduleDecl(tp) + " " + r->getName() + "(";
 
         for (int i = 0; i < (int) pts.size(); i++) {
           out << "." << pts[i].getName() << "(" << verilogString(r->pt(pts[i].getName()), m) << ")";
@@ -514,10 +1122,7 @@ namespace CAC {
 	}
     }
 
-	cout << "Used in delayed activations..." << endl;
     for (auto pt : usedInDelayedActivation) {
-    	cout << "\t" << pt << endl;
-
 	out << "\treg " << verilogStringLastCycle(pt, m) << ";" << endl;
     }
 
@@ -565,14 +1170,6 @@ namespace CAC {
       }
     }
 
-    cout << "All port setters" << endl;
-    for (auto entry : setters) {
-      cout << entry.first << ": set by..." << endl;
-      for (auto instr : entry.second) {
-        cout << "\t" << *instr << endl;
-      }
-    }
-
      for (auto entry : setters) {
        Port pt = entry.first;
        out << "\t// Controller for port " << pt << endl;
@@ -622,25 +1219,33 @@ namespace CAC {
        out << "\talways @(*) begin" << endl;
        out << "\t\tif (rst) begin" << endl;
 
-       for (auto c : resetConds) {
-	 out << "\t\t\tif (" << c.first << ") begin" << endl;
-	 out << "\t\t\t\t" << verilogString(pt, m) << " = " << verilogString(c.second, m) << ";" << endl;
-	 out << "\t\t\tend else " << endl;
+       if (options.parallelMuxes) {
+         out << "\t\t\t" << verilogString(pt, m) << " = " << parallelMuxString(pt, resetConds, defaultStr, m) << ";" << endl;
+       } else {
+         for (auto c : resetConds) {
+           out << "\t\t\tif (" << c.first << ") begin" << endl;
+           out << "\t\t\t\t" << verilogString(pt, m) << " = " << verilogString(c.second, m) << ";" << endl;
+           out << "\t\t\tend else " << endl;
+         }
+         out << "\t\t\tbegin" << endl;
+         out << "\t\t\t\t" << verilogString(pt, m) << " = " << defaultStr << ";" << endl;
+         out << "\t\t\tend" << endl;
        }
-       out << "\t\t\tbegin" << endl;
-       out << "\t\t\t\t" << verilogString(pt, m) << " = " << defaultStr << ";" << endl;
-       out << "\t\t\tend" << endl;
         
        out << "\t\tend else begin" << endl;
 
-       for (auto c : nonResetConds) {
-	 out << "\t\t\tif (" << c.first << ") begin" << endl;
-	 out << "\t\t\t\t" << verilogString(pt, m) << " = " << verilogString(c.second, m) << ";" << endl;
-	 out << "\t\t\tend else " << endl;
+       if (options.parallelMuxes) {
+         out << "\t\t\t" << verilogString(pt, m) << " = " << parallelMuxString(pt, nonResetConds, defaultStr, m) << ";" << endl;
+       } else {
+         for (auto c : nonResetConds) {
+           out << "\t\t\tif (" << c.first << ") begin" << endl;
+           out << "\t\t\t\t" << verilogString(pt, m) << " = " << verilogString(c.second, m) << ";" << endl;
+           out << "\t\t\tend else " << endl;
+         }
+         out << "\t\t\tbegin" << endl;
+         out << "\t\t\t\t" << verilogString(pt, m) << " = " << defaultStr << ";" << endl;
+         out << "\t\t\tend" << endl;
        }
-       out << "\t\t\tbegin" << endl;
-       out << "\t\t\t\t" << verilogString(pt, m) << " = " << defaultStr << ";" << endl;
-       out << "\t\t\tend" << endl;
 
        out << "\t\tend" << endl;
        out << "\tend" << endl;        
@@ -718,8 +1323,11 @@ namespace CAC {
       }
     }
 
+    if (options.profileCounters) {
+      emitProfileCounters(m, out, options);
+    }
+
     out << "endmodule";
-    out.close();
   }
 
   void print(std::ostream& out, Module* source) {
@@ -727,11 +1335,14 @@ namespace CAC {
   }
 
   Module* getNotMod(Context& c, const int width) {
-    string name = "not_" + to_string(width);
-    if (c.hasModule(name)) {
-      return c.getModule(name);
+    PrimitiveKey key(PRIMITIVE_KIND_NOT, width, 0);
+    Module* cached = c.getPrimitive(key);
+    if (cached != nullptr) {
+      return cached;
     }
 
+    string name = "not_" + to_string(width);
+
     auto regMod = c.addCombModule(name);
 
     regMod->setPrimitive(true);
@@ -749,29 +1360,37 @@ namespace CAC {
 
     regMod->setVerilogDeclString("notOp #(.WIDTH(" + to_string(width) + "))");
 
+    c.addPrimitive(key, regMod);
     return regMod;
   }
 
   Module* getChannelMod(Context& c, const int width) {
-    string name = "pipe_channel_" + to_string(width);
-    if (c.hasModule(name)) {
-      return c.getModule(name);
+    PrimitiveKey key(PRIMITIVE_KIND_CHANNEL, width, 0);
+    Module* cached = c.getPrimitive(key);
+    if (cached != nullptr) {
+      return cached;
     }
 
+    string name = "pipe_channel_" + to_string(width);
     auto regMod = c.addCombModule(name);
 
     regMod->setPrimitive(true);
     regMod->addInPort(width, "in");
     regMod->addOutPort(width, "out");
+
+    c.addPrimitive(key, regMod);
     return regMod;
   }
   
   Module* getRegMod(Context& c, const int width) {
-    string name = "reg_" + to_string(width);
-    if (c.hasModule(name)) {
-      return c.getModule(name);
+    PrimitiveKey key(PRIMITIVE_KIND_REGISTER, width, 0);
+    Module* cached = c.getPrimitive(key);
+    if (cached != nullptr) {
+      return cached;
     }
 
+    string name = "reg_" + to_string(width);
+
     auto regMod = c.addModule(name);
 
     regMod->setPrimitive(true);
@@ -803,21 +1422,26 @@ namespace CAC {
     regMod->addAction(regModSt);
 
     regMod->setVerilogDeclString("mod_register #(.WIDTH(" + to_string(width) + "))");    
+
+    c.addPrimitive(key, regMod);
     return regMod;
 
   }
 
   Module* getConstMod(Context& c, const int width, const int value) {
-    string name = "const_" + to_string(width) + "_" + to_string(value);
-    if (c.hasModule(name)) {
-      return c.getModule(name);
+    PrimitiveKey key(PRIMITIVE_KIND_CONSTANT, width, value);
+    Module* cached = c.getPrimitive(key);
+    if (cached != nullptr) {
+      return cached;
     }
 
+    string name = "const_" + to_string(width) + "_" + to_string(value);
     CAC::Module* w = c.addCombModule(name);
     w->setPrimitive(true);
     w->addOutPort(width, "out");
     w->setVerilogDeclString("constant #(.WIDTH(" + to_string(width) + "), .VALUE(" + to_string(value) + "))");
   
+    c.addPrimitive(key, w);
     return w;
 
   }
@@ -997,7 +1621,7 @@ namespace CAC {
 
         set<ModuleInstance*> newOut;
         for (auto act : instr->continuations) {
-          for (auto c : map_find(instr, liveIn)) {
+          for (auto c : map_find(act.destination, liveIn)) {
             newOut.insert(c);
           }
         }
@@ -1049,6 +1673,9 @@ namespace CAC {
       source->connection.second : source->connection.first;
     deque<pair<CC*, Port> > valsAndSources{{source, origPort}};
     set<CC*> visited;
+    // A CC reached along several paths only needs to be expanded once.
+    // Later visits only added registers that nothing reads.
+    set<CC*> queued{source};
     set<CC*> original;
     for (auto cc : container->getBody()) {
       original.insert(cc);
@@ -1066,18 +1693,31 @@ namespace CAC {
       CC* val = valAndSrc.first;
       Port src = valAndSrc.second;
 
-      int chanWidth = src.getWidth();
-      ModuleInstance* freshReg =
-        container->freshInstanceSeq(getRegMod(*(container->getContext()), chanWidth), chan->getName());
-      CC* storeRegVal =
-        container->addInvokeInstruction(freshReg->source->action(freshReg->source->getName() + "_st"));
-      bindByType(storeRegVal, freshReg);
-      storeRegVal->bind("in", src);
-      storeRegVal->bind("en", container->constOut(1, 1));
+      // The value only needs to be registered if it is read in a later cycle
+      bool readLater = false;
+      for (auto c : val->continuations) {
+        CC* dest = c.destination;
+        if (c.delay > 0 && elem(dest, original) && !elem(dest, visited) &&
+            elem(chan, map_find(dest, liveIn))) {
+          readLater = true;
+        }
+      }
+
+      Port nextVal = src;
+      if (readLater) {
+        int chanWidth = src.getWidth();
+        ModuleInstance* freshReg =
+          container->freshInstanceSeq(getRegMod(*(container->getContext()), chanWidth), chan->getName());
+        CC* storeRegVal =
+          container->addInvokeInstruction(freshReg->source->action(freshReg->source->getName() + "_st"));
+        bindByType(storeRegVal, freshReg);
+        storeRegVal->bind("in", src);
+        storeRegVal->bind("en", container->constOut(1, 1));
 
-      val->continueTo(container->constOut(1, 1), storeRegVal, 0);
-      
-      Port nextVal = freshReg->pt("data");
+        val->continueTo(container->constOut(1, 1), storeRegVal, 0);
+
+        nextVal = freshReg->pt("data");
+      }
 
       // TODO: Replace connections to chan->pt("out") with nextVal?
       for (auto c : val->continuations) {
@@ -1100,6 +1740,14 @@ namespace CAC {
           //     valsAndSources.push_back({dest, nextVal});
           //   }
           // }
+          // Nothing downstream of dest reads the channel before it is
+          // written again, so there is no value to carry forward.
+          if (elem(dest, queued) ||
+              !elem(chan, map_find(dest, liveIn))) {
+            continue;
+          }
+          queued.insert(dest);
+
           if (c.delay == 0) {
             valsAndSources.push_back({dest, src});            
           } else {
@@ -1254,30 +1902,35 @@ namespace CAC {
     return source->action(source->getName() + "_" + actionSuffix);
   }
 
-  void addBinop(Context& c, const std::string& name, const int cycleLatency) {
+  Module* addBinop(Context& c,
+                   const std::string& name,
+                   const std::string& verilogMod,
+                   const int width,
+                   const int cycleLatency) {
     if (c.hasModule(name)) {
-      return;
+      return c.getModule(name);
     }
     
     Module* const_1_1 = getConstMod(c, 1, 1);
 
-    Module* add16 = c.addCombModule(name);
+    // Multicycle operators register their result, so they need a clock
+    Module* add16 = cycleLatency > 0 ? c.addModule(name) : c.addCombModule(name);
     add16->setPrimitive(true);
-    add16->addInPort(16, "in0");
-    add16->addInPort(16, "in1");
-    add16->addOutPort(16, "out");
+    add16->addInPort(width, "in0");
+    add16->addInPort(width, "in1");
+    add16->addOutPort(width, "out");
 
     assert(!add16->ept("in0").isOutput());  
     assert(!add16->ept("out").isInput);
   
     Module* add16Inv = c.addModule(name + "_apply");
-    add16Inv->addInPort(16, "in0");
-    add16Inv->addInPort(16, "in1");
-    add16Inv->addOutPort(16, "out");    
+    add16Inv->addInPort(width, "in0");
+    add16Inv->addInPort(width, "in1");
+    add16Inv->addOutPort(width, "out");    
 
-    add16Inv->addOutPort(16, name + "_in0");
-    add16Inv->addOutPort(16, name + "_in1");
-    add16Inv->addInPort(16, name + "_out");
+    add16Inv->addOutPort(width, name + "_in0");
+    add16Inv->addOutPort(width, name + "_in1");
+    add16Inv->addInPort(width, name + "_out");
 
     assert(add16Inv->ept(name + "_in0").isOutput());  
     assert(add16Inv->ept(name + "_out").isInput);
@@ -1295,19 +1948,119 @@ namespace CAC {
     in1W->continueTo(oneInst->pt("out"), outW, cycleLatency);
 
     add16->addAction(add16Inv);
+
+    string params = ".WIDTH(" + to_string(width) + ")";
+    if (cycleLatency > 0) {
+      params += ", .LATENCY(" + to_string(cycleLatency) + ")";
+    }
+    add16->setVerilogDeclString(verilogMod + " #(" + params + ")");
+
+    return add16;
+  }
+
+  class BinopSpec {
+  public:
+    std::string verilogMod;
+    int latency;
+  };
+
+  // Operators with a nonzero latency are pipelined builtins that take
+  // a LATENCY parameter
+  static map<string, BinopSpec> binopSpecs{
+    {"add", {"add", 0}},
+    {"sub", {"sub", 0}},
+    {"and", {"andOp", 0}},
+    {"or", {"orOp", 0}},
+    {"xor", {"xorOp", 0}},
+    {"shl", {"shlOp", 0}},
+    {"lshr", {"lshrOp", 0}},
+    {"ashr", {"ashrOp", 0}},
+    {"mul", {"mulPipe", 2}},
+    {"sdiv", {"sdivPipe", 4}},
+    {"udiv", {"udivPipe", 4}},
+    {"srem", {"sremPipe", 4}},
+    {"urem", {"uremPipe", 4}}
+  };
+
+  bool isSupportedBinop(const std::string& op) {
+    return contains_key(op, binopSpecs);
+  }
+
+  int binopLatency(const std::string& op) {
+    if (!isSupportedBinop(op)) {
+      cout << "Error: No binary operator named " << op << endl;
+      assert(false);
+    }
+    return map_find(op, binopSpecs).latency;
+  }
+
+  int operatorDelay(const std::string& op, const int width) {
+    if (op == "and" || op == "or" || op == "xor" || op == "not") {
+      return 1;
+    }
+
+    // Reduction trees of 6 input LUTs
+    if (op == "eq" || op == "ne") {
+      return 1 + (ceilLog2(width) + 2) / 3;
+    }
+
+    // Barrel shifters, with a 4:1 mux per LUT
+    if (op == "shl" || op == "lshr" || op == "ashr") {
+      return max(1, (ceilLog2(width) + 1) / 2);
+    }
+
+    // Carry chains
+    if (op == "add" || op == "sub" ||
+        op == "sgt" || op == "sge" || op == "slt" || op == "sle" ||
+        op == "ugt" || op == "uge" || op == "ult" || op == "ule") {
+      return 1 + (width + 15) / 16;
+    }
+
+    // Pipelined operators register their inputs
+    if (isSupportedBinop(op) && binopLatency(op) > 0) {
+      return 1;
+    }
+
+    cout << "Error: No delay for operator " << op << endl;
+    assert(false);
+    return 0;
+  }
+
+  Module* getBinopMod(Context& c, const std::string& op, const int width) {
+    if (!isSupportedBinop(op)) {
+      cout << "Error: No binary operator named " << op << endl;
+      assert(false);
+    }
+    BinopSpec spec = map_find(op, binopSpecs);
+    return addBinop(c, op + "_" + to_string(width), spec.verilogMod, width, spec.latency);
+  }
+
+  Module* getComparatorMod(Context& c, const std::string& op, const int width) {
+    return addComparator(c, op + "_" + to_string(width), op, width);
   }
 
   void deleteNoEffectInstructions(Module* m) {
-    set<CC*> noEffect;
-    for (auto instr : m->getBody()) {
-      if (instr->isEmpty() && instr->continuations.size() == 0) {
-        noEffect.insert(instr);
+    // Deleting an instruction can leave its predecessors with no
+    // successors, so repeat until nothing changes
+    bool foundNoEffect = true;
+    while (foundNoEffect) {
+      set<CC*> noEffect;
+      for (auto instr : m->getBody()) {
+        if (instr->isEmpty() && instr->continuations.size() == 0) {
+          noEffect.insert(instr);
+        }
       }
-    }
+      foundNoEffect = noEffect.size() > 0;
 
-    // 28.5k before, 25.7 after
-    for (auto instr : noEffect) {
-      m->deleteInstr(instr);
+      // 28.5k before, 25.7 after
+      for (auto instr : m->getBody()) {
+        delete_if(instr->continuations, [&noEffect](const Activation& act) {
+            return elem(act.destination, noEffect);
+          });
+      }
+      for (auto instr : noEffect) {
+        m->deleteInstr(instr);
+      }
     }
 
     // Now: Delete instructions with one dest?
@@ -1343,6 +2096,279 @@ namespace CAC {
     }
   }
 
+  void deleteUnreachableInstructions(Module* m) {
+    int deadActivations = 0;
+    for (auto instr : m->getBody()) {
+      int before = instr->continuations.size();
+      delete_if(instr->continuations, [](const Activation& act) {
+          return isConstantValue(act.condition, 0);
+        });
+      deadActivations += before - instr->continuations.size();
+    }
+    cout << "# of activations with constant false conditions = " << deadActivations << endl;
+
+    set<CC*> reachable;
+    deque<CC*> toVisit;
+    for (auto instr : m->getBody()) {
+      if (instr->isStartAction) {
+        reachable.insert(instr);
+        toVisit.push_back(instr);
+      }
+    }
+
+    while (toVisit.size() > 0) {
+      CC* next = toVisit.front();
+      toVisit.pop_front();
+
+      for (auto act : next->continuations) {
+        if (!elem(act.destination, reachable)) {
+          reachable.insert(act.destination);
+          toVisit.push_back(act.destination);
+        }
+      }
+    }
+
+    // Only unreachable instructions can jump to unreachable instructions,
+    // so deleting them cannot leave dangling activations
+    int unreachable = 0;
+    for (auto instr : m->getBody()) {
+      if (!elem(instr, reachable)) {
+        unreachable++;
+        m->deleteInstr(instr);
+      }
+    }
+    cout << "# of unreachable instructions = " << unreachable << endl;
+
+    deleteDeadResources(m);
+  }
+
+  void replacePortEverywhere(Module* m, Port toReplace, Port replacement) {
+    for (auto instr : m->getBody()) {
+      replacePort(toReplace, replacement, instr);
+    }
+    m->replaceStructuralPort(toReplace, replacement);
+  }
+
+  int64_t maskTo(const int64_t value, const int width) {
+    if (width >= 64) {
+      return value;
+    }
+    return value & ((((int64_t) 1) << width) - 1);
+  }
+
+  int64_t signExtend(const int64_t value, const int width) {
+    int64_t v = maskTo(value, width);
+    if (width < 64 && ((v >> (width - 1)) & 1)) {
+      return v - (((int64_t) 1) << width);
+    }
+    return v;
+  }
+
+  // Constant modules hold ints that are sign extended to the constant's
+  // width, so wide values are stored as their signed interpretation and
+  // values that do not fit in an int cannot be stored at all
+  bool constModValue(const int64_t value, const int width, int& stored) {
+    int64_t v = width >= 32 ? signExtend(value, width) : maskTo(value, width);
+    if ((v < INT_MIN) || (v > INT_MAX)) {
+      return false;
+    }
+    stored = (int) v;
+    return true;
+  }
+
+  // Value of a constant driving pt through a structural connection, if
+  // pt is never also set by an instruction
+  bool constantDriver(Port pt,
+                      Module* m,
+                      const set<Port>& setByInstructions,
+                      int64_t& value) {
+    if (elem(pt, setByInstructions)) {
+      return false;
+    }
+
+    for (auto sc : m->getStructuralConnections()) {
+      if ((sc.first == pt) && isConstant(sc.second)) {
+        value = maskTo(constantValue(sc.second.inst), pt.getWidth());
+        return true;
+      }
+      if ((sc.second == pt) && isConstant(sc.first)) {
+        value = maskTo(constantValue(sc.first.inst), pt.getWidth());
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool evaluateConstantOp(ModuleInstance* op,
+                          const map<string, int64_t>& inputs,
+                          int64_t& result) {
+    string name = verilogModuleName(op->source);
+    int w = op->pt("out").getWidth();
+
+    if (name == "mod_wire" || name == "notOp") {
+      int64_t in = map_find(string("in"), inputs);
+      result = name == "notOp" ? ~in : in;
+      result = maskTo(result, w);
+      return true;
+    }
+
+    if (!contains_key(string("in0"), inputs) ||
+        !contains_key(string("in1"), inputs) ||
+        (inputs.size() != 2)) {
+      return false;
+    }
+
+    int inW = op->pt("in0").getWidth();
+    int64_t a = map_find(string("in0"), inputs);
+    int64_t b = map_find(string("in1"), inputs);
+    int64_t sa = signExtend(a, inW);
+    int64_t sb = signExtend(b, inW);
+
+    if (name == "eq") {
+      result = a == b;
+    } else if (name == "ne") {
+      result = a != b;
+    } else if (name == "sgt") {
+      result = sa > sb;
+    } else if (name == "sge") {
+      result = sa >= sb;
+    } else if (name == "slt") {
+      result = sa < sb;
+    } else if (name == "sle") {
+      result = sa <= sb;
+    } else if (name == "ugt") {
+      result = a > b;
+    } else if (name == "uge") {
+      result = a >= b;
+    } else if (name == "ult") {
+      result = a < b;
+    } else if (name == "ule") {
+      result = a <= b;
+    } else if (name == "add") {
+      result = a + b;
+    } else if (name == "sub") {
+      result = a - b;
+    } else if (name == "andOp") {
+      result = a & b;
+    } else if (name == "orOp") {
+      result = a | b;
+    } else if (name == "xorOp") {
+      result = a ^ b;
+    } else if (name == "shlOp") {
+      result = b >= w ? 0 : a << b;
+    } else if (name == "lshrOp") {
+      result = b >= w ? 0 : a >> b;
+    } else if (name == "ashrOp") {
+      result = b >= w ? (sa < 0 ? -1 : 0) : sa >> b;
+    } else {
+      return false;
+    }
+    result = maskTo(result, w);
+    return true;
+  }
+
+  void foldConstants(Module* m) {
+    Context& c = *(m->getContext());
+
+    // One instance per constant module
+    map<Module*, ModuleInstance*> canonical;
+    int duplicateConsts = 0;
+    for (auto r : m->getResources()) {
+      if (!isConstant(r)) {
+        continue;
+      }
+
+      if (!contains_key(r->source, canonical)) {
+        canonical[r->source] = r;
+      } else {
+        replacePortEverywhere(m, r->pt("out"), map_find(r->source, canonical)->pt("out"));
+        m->erase(r);
+        duplicateConsts++;
+      }
+    }
+    cout << "# of duplicate constants removed = " << duplicateConsts << endl;
+
+    auto constPort = [&c, m, &canonical](const int width, const int value) {
+      Module* cm = getConstMod(c, width, value);
+      if (!contains_key(cm, canonical)) {
+        canonical[cm] = m->freshInstance(cm, "const");
+      }
+      return map_find(cm, canonical)->pt("out");
+    };
+
+    // Push constants through combinational primitives whose inputs are
+    // all driven by constants
+    int foldedOps = 0;
+    set<ModuleInstance*> foldedAway;
+    bool folded = true;
+    while (folded) {
+      folded = false;
+
+      set<Port> setByInstructions;
+      for (auto instr : m->getBody()) {
+        for (auto pt : allReferencedPorts(instr)) {
+          setByInstructions.insert(pt);
+        }
+      }
+
+      for (auto r : m->getResources()) {
+        if (isConstant(r) || elem(r, foldedAway) ||
+            !r->source->isPrimitiveModule() || !r->hasPt("out")) {
+          continue;
+        }
+
+        map<string, int64_t> inputs;
+        bool allConstant = true;
+        for (auto pt : r->getPorts()) {
+          if (pt.isInput) {
+            int64_t value;
+            if (!constantDriver(pt, m, setByInstructions, value)) {
+              allConstant = false;
+              break;
+            }
+            inputs[pt.getName()] = value;
+          }
+        }
+
+        int64_t result;
+        int stored;
+        if (allConstant && evaluateConstantOp(r, inputs, result) &&
+            constModValue(result, r->pt("out").getWidth(), stored)) {
+          Port out = r->pt("out");
+          replacePortEverywhere(m, out, constPort(out.getWidth(), stored));
+          foldedAway.insert(r);
+          foldedOps++;
+          folded = true;
+        }
+      }
+    }
+    cout << "# of operations folded to constants = " << foldedOps << endl;
+
+    // Fold constant activation conditions
+    int foldedConds = 0;
+    Port trueCond = constPort(1, 1);
+    for (auto instr : m->getBody()) {
+      delete_if(instr->continuations, [&foldedConds](const Activation& act) {
+          if (isConstant(act.condition) &&
+              maskTo(constantValue(act.condition.inst), act.condition.getWidth()) == 0) {
+            foldedConds++;
+            return true;
+          }
+          return false;
+        });
+
+      for (Activation& act : instr->continuations) {
+        if (isConstant(act.condition) && !(act.condition == trueCond)) {
+          act.condition = trueCond;
+          foldedConds++;
+        }
+      }
+    }
+    cout << "# of activation conditions folded = " << foldedConds << endl;
+
+    deleteDeadResources(m);
+  }
+
   bool Module::isDead(ModuleInstance* inst) {
     //cout << "Checking if " << inst->getName() << " is dead" << endl;
     vector<Port> outPts = inst->getOutPorts();
@@ -1399,6 +2425,13 @@ namespace CAC {
 
 
   Module* addComparator(Context& c, const std::string& name, const int width) {
+    return addComparator(c, name, name, width);
+  }
+
+  Module* addComparator(Context& c,
+                        const std::string& name,
+                        const std::string& verilogMod,
+                        const int width) {
     if (c.hasModule(name)) {
       return c.getModule(name);
     }
@@ -1440,9 +2473,301 @@ namespace CAC {
 
     cmpM->addAction(cmpMInv);
 
-    cmpM->setVerilogDeclString(name + " #(.WIDTH(" + to_string(width) + "))");
+    cmpM->setVerilogDeclString(verilogMod + " #(.WIDTH(" + to_string(width) + "))");
 
     return cmpM;
 
   }
 }
+
+namespace CAC {
+
+  // LUT6 trees that combine a number of signals
+  static int lutTreeLevels(const int inputs) {
+    int levels = 1;
+    int reach = 6;
+    while (reach < inputs) {
+      reach *= 6;
+      levels++;
+    }
+    return levels;
+  }
+
+  static int lutTreeSize(const int inputs) {
+    return max(1, (inputs + 3) / 5);
+  }
+
+  static int declParam(const std::string& decl, const std::string& param) {
+    string key = "." + param + "(";
+    size_t pos = decl.find(key);
+    if (pos == string::npos) {
+      return -1;
+    }
+    return stoi(decl.substr(pos + key.size()));
+  }
+
+  static int primitiveWidth(Module* prim) {
+    for (string name : {"in0", "in", "in_data", "out"}) {
+      if (prim->hasPort(name)) {
+        return prim->ept(name).getWidth();
+      }
+    }
+    return 0;
+  }
+
+  // Cost of one instance of a primitive, keyed by the builtins.v module it
+  // is emitted as. Returns false for primitives with no entry
+  static bool primitiveCost(Module* prim, PrimitiveCost& cost) {
+    string decl = prim->getVerilogDeclString();
+    string verilogMod = decl.substr(0, decl.find_first_of(" #"));
+    int w = primitiveWidth(prim);
+
+    static map<string, string> opsForMods{
+      {"add", "add"}, {"sub", "sub"},
+      {"andOp", "and"}, {"orOp", "or"}, {"xorOp", "xor"}, {"notOp", "not"},
+      {"shlOp", "shl"}, {"lshrOp", "lshr"}, {"ashrOp", "ashr"},
+      {"eq", "eq"}, {"ne", "ne"},
+      {"sgt", "sgt"}, {"sge", "sge"}, {"slt", "slt"}, {"sle", "sle"},
+      {"ugt", "ugt"}, {"uge", "uge"}, {"ult", "ult"}, {"ule", "ule"}};
+
+    cost = {0, 0, 0};
+    if (verilogMod == "constant" || verilogMod == "mod_wire" ||
+        verilogMod == "sext" || verilogMod == "zext" ||
+        verilogMod == "trunc" || verilogMod == "sliceOp" ||
+        verilogMod == "mixOp" || verilogMod == "concat") {
+      return true;
+    } else if (verilogMod == "mod_register") {
+      cost.flops = w;
+    } else if (verilogMod == "select") {
+      cost.luts = w;
+      cost.delay = 1;
+    } else if (contains_key(verilogMod, opsForMods)) {
+      string op = map_find(verilogMod, opsForMods);
+      cost.delay = operatorDelay(op, w);
+      if (op == "eq" || op == "ne") {
+        cost.luts = lutTreeSize(2*w);
+      } else if (op == "shl" || op == "lshr" || op == "ashr") {
+        cost.luts = w*cost.delay;
+      } else {
+        cost.luts = w;
+      }
+    } else if (verilogMod == "mulPipe") {
+      cost.flops = w*declParam(decl, "LATENCY");
+      cost.luts = w*w / 2;
+    } else if (verilogMod == "sdivPipe" || verilogMod == "udivPipe" ||
+               verilogMod == "sremPipe" || verilogMod == "uremPipe") {
+      cost.flops = w*declParam(decl, "LATENCY");
+      cost.luts = w*w;
+    } else if (verilogMod == "fifo") {
+      int depth = declParam(decl, "DEPTH");
+      cost.flops = w*depth + 2*ceilLog2(depth) + 1;
+      cost.luts = w*lutTreeSize(depth) + 2*ceilLog2(depth);
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  // Timing graph of a lowered module. Nodes are the ports of its resources
+  // and interface, plus the happened signal of each CC. Each node keeps the
+  // nodes that drive it combinationally along with the LUT levels in
+  // between.
+  class TimingGraph {
+  public:
+    vector<string> names;
+    vector<vector<pair<int, int> > > drivers;
+    map<Port, int> portNodes;
+    map<CC*, int> ccNodes;
+
+    int node(const Port pt) {
+      if (!contains_key(pt, portNodes)) {
+        portNodes[pt] = names.size();
+        names.push_back(pt.toString());
+        drivers.push_back({});
+      }
+      return map_find(pt, portNodes);
+    }
+
+    int node(CC* instr) {
+      if (!contains_key(instr, ccNodes)) {
+        ccNodes[instr] = names.size();
+        names.push_back(instr->isConnect() ?
+                        "happened of " + dest(instr).toString() :
+                        "happened of empty CC");
+        drivers.push_back({});
+      }
+      return map_find(instr, ccNodes);
+    }
+
+    void addEdge(const int from, const int to, const int delay) {
+      drivers[to].push_back({from, delay});
+    }
+
+    // LUT levels between the latest driving flop or input and n.
+    // Unvisited nodes have arrival -1 and nodes being visited -2, so
+    // combinational loops are broken at the edge that closes them
+    int arrival(const int n, vector<int>& arrivals, vector<int>& prev) {
+      if (arrivals[n] >= 0) {
+        return arrivals[n];
+      }
+
+      arrivals[n] = -2;
+      int latest = 0;
+      for (auto d : drivers[n]) {
+        if (arrivals[d.first] == -2) {
+          continue;
+        }
+
+        int a = arrival(d.first, arrivals, prev) + d.second;
+        if (a > latest) {
+          latest = a;
+          prev[n] = d.first;
+        }
+      }
+      arrivals[n] = latest;
+      return latest;
+    }
+  };
+
+  ModuleEstimate estimateModule(Module* m) {
+    ModuleEstimate est;
+    est.flops = 0;
+    est.luts = 0;
+    est.criticalPath = 0;
+
+    TimingGraph g;
+    for (auto r : m->getResources()) {
+      Module* src = r->source;
+      if (!src->isPrimitiveModule()) {
+        // Submodules register their interfaces, so only their own paths count
+        ModuleEstimate sub = estimateModule(src);
+        est.flops += sub.flops;
+        est.luts += sub.luts;
+        for (auto b : sub.blackBoxes) {
+          est.blackBoxes.insert(b);
+        }
+        if (sub.criticalPath > est.criticalPath) {
+          est.criticalPath = sub.criticalPath;
+          est.criticalPathNodes = sub.criticalPathNodes;
+        }
+        continue;
+      }
+
+      PrimitiveCost cost;
+      if (!primitiveCost(src, cost)) {
+        est.blackBoxes.insert(src->getName());
+        continue;
+      }
+
+      est.flops += cost.flops;
+      est.luts += cost.luts;
+      if (src->hasPort("clk")) {
+        continue;
+      }
+
+      for (auto out : r->getOutPorts()) {
+        for (auto in : r->getPorts()) {
+          if (in.isInput) {
+            g.addEdge(g.node(in), g.node(out), cost.delay);
+          }
+        }
+      }
+    }
+
+    for (auto sc : m->getStructuralConnections()) {
+      g.addEdge(g.node(sc.second), g.node(sc.first), 0);
+    }
+
+    // Each CC has a happened signal that ORs together the activations that
+    // reach it, and a flop that remembers it for delayed activations
+    map<CC*, vector<pair<CC*, Activation> > > activations;
+    set<Port> delayedConditions;
+    for (auto instr : m->getBody()) {
+      if (!instr->isConnect() && !instr->isEmpty()) {
+        cout << "Error: Estimating module " << m->getName() << " before invokes are inlined" << endl;
+        assert(false);
+      }
+
+      for (auto act : instr->continuations) {
+        activations[act.destination].push_back({instr, act});
+        if (act.delay == 1 && !isConstant(act.condition)) {
+          delayedConditions.insert(act.condition);
+        }
+      }
+    }
+
+    for (auto instr : m->getBody()) {
+      est.flops++;
+
+      vector<pair<CC*, Activation> > acts = activations[instr];
+      est.luts += lutTreeSize(2*acts.size());
+      int levels = lutTreeLevels(2*acts.size());
+      for (auto act : acts) {
+        if (act.second.delay == 0) {
+          g.addEdge(g.node(act.first), g.node(instr), levels);
+          g.addEdge(g.node(act.second.condition), g.node(instr), levels);
+        }
+      }
+    }
+
+    for (auto pt : delayedConditions) {
+      est.flops += pt.getWidth();
+    }
+
+    // Ports set by several CCs get a mux that picks the value of the CC
+    // that happened
+    map<Port, vector<CC*> > setters;
+    for (auto instr : m->getBody()) {
+      if (instr->isConnect()) {
+        setters[dest(instr)].push_back(instr);
+      }
+    }
+
+    for (auto entry : setters) {
+      Port pt = entry.first;
+      int inputs = 2*entry.second.size();
+      est.luts += pt.getWidth()*lutTreeSize(inputs);
+      for (auto instr : entry.second) {
+        g.addEdge(g.node(source(instr)), g.node(pt), lutTreeLevels(inputs));
+        g.addEdge(g.node(instr), g.node(pt), lutTreeLevels(inputs));
+      }
+    }
+
+    vector<int> arrivals(g.names.size(), -1);
+    vector<int> prev(g.names.size(), -1);
+    int last = -1;
+    for (int n = 0; n < (int) g.names.size(); n++) {
+      int a = g.arrival(n, arrivals, prev);
+      if (a > est.criticalPath) {
+        est.criticalPath = a;
+        last = n;
+      }
+    }
+
+    if (last >= 0) {
+      est.criticalPathNodes = {};
+      for (int n = last; n >= 0; n = prev[n]) {
+        est.criticalPathNodes.insert(begin(est.criticalPathNodes), g.names[n]);
+      }
+    }
+
+    return est;
+  }
+
+  std::ostream& operator<<(std::ostream& out, const ModuleEstimate& est) {
+    out << "Flops         = " << est.flops << endl;
+    out << "LUTs          = " << est.luts << endl;
+    out << "Critical path = " << est.criticalPath << " LUT levels" << endl;
+    for (auto n : est.criticalPathNodes) {
+      out << "\t" << n << endl;
+    }
+    if (est.blackBoxes.size() > 0) {
+      out << "Not counted:" << endl;
+      for (auto b : est.blackBoxes) {
+        out << "\t" << b << endl;
+      }
+    }
+    return out;
+  }
+
+}
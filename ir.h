@@ -139,6 +139,9 @@ namespace CAC {
   public:
     ConnectAndContinueType tp;
     bool isStartAction;
+    // Names the block of the source program that starts here, for
+    // profile counters
+    std::string profileLabel;
     pair<Port, Port> connection;
     std::vector<Activation> continuations;
 
@@ -215,6 +218,10 @@ namespace CAC {
   typedef Module CallingConvention;
 
   Module* getConstMod(Context& c, const int width, const int value);
+
+  bool isConstant(ModuleInstance* inst);
+  bool isConstant(Port pt);
+  int constantValue(ModuleInstance* inst);
   Module* getRegMod(Context& c, const int width);
   Module* getChannelMod(Context& c, const int width);
   Module* getNotMod(Context& c, const int width);
@@ -380,6 +387,17 @@ namespace CAC {
       addStructuralConnection(a, b);
     }
 
+    void replaceStructuralPort(const Port toReplace, const Port replacement) {
+      for (auto& sc : structuralConnections) {
+        if (sc.first == toReplace) {
+          sc.first = replacement;
+        }
+        if (sc.second == toReplace) {
+          sc.second = replacement;
+        }
+      }
+    }
+
     std::set<CC*> getBody() const { return body; }
     std::set<ModuleInstance*> getResources() const { return resources; }    
 
@@ -532,6 +550,10 @@ namespace CAC {
       isPrimitive = isPrim;
     }
 
+    bool isPrimitiveModule() const {
+      return isPrimitive;
+    }
+
     void addInPort(const int width, const std::string& name) {
       assert(!contains_key(name, primPorts));
 
@@ -611,11 +633,57 @@ namespace CAC {
     std::string getName() const { return name; }
   };
 
+  enum PrimitiveKind {
+    PRIMITIVE_KIND_WIRE,
+    PRIMITIVE_KIND_CONSTANT,
+    PRIMITIVE_KIND_REGISTER,
+    PRIMITIVE_KIND_CHANNEL,
+    PRIMITIVE_KIND_NOT
+  };
+
+  class PrimitiveKey {
+  public:
+    PrimitiveKind kind;
+    int width;
+    int value;
+
+    PrimitiveKey(const PrimitiveKind kind_, const int width_, const int value_) :
+      kind(kind_), width(width_), value(value_) {}
+  };
+
+  static inline
+  bool operator==(const PrimitiveKey& a, const PrimitiveKey& b) {
+    return (a.kind == b.kind) && (a.width == b.width) && (a.value == b.value);
+  }
+
+  class PrimitiveKeyHash {
+  public:
+    size_t operator()(const PrimitiveKey& k) const {
+      size_t h = std::hash<int>()(k.kind);
+      h = h*31 + std::hash<int>()(k.width);
+      h = h*31 + std::hash<int>()(k.value);
+      return h;
+    }
+  };
+
   class Context {
     std::map<std::string, Module*> mods;
+    std::unordered_map<PrimitiveKey, Module*, PrimitiveKeyHash> primitives;
     
   public:
 
+    // Cached primitive modules (wires, constants, registers, ...), looked
+    // up by what they are so the getters skip building and searching names
+    Module* getPrimitive(const PrimitiveKey& key) {
+      auto it = primitives.find(key);
+      return it == primitives.end() ? nullptr : it->second;
+    }
+
+    void addPrimitive(const PrimitiveKey& key, Module* m) {
+      assert(getPrimitive(key) == nullptr);
+      primitives[key] = m;
+    }
+
     Module* getModule(const std::string& name) {
       if (!hasModule(name)) {
         cout << "Error: No module named " << name << " available" << endl;
@@ -656,10 +724,98 @@ namespace CAC {
     
   };
 
+  class VerilogEmitOptions {
+  public:
+    // Emit each port controller as an AND-OR mux over its setters instead
+    // of a priority if / else if chain
+    bool parallelMuxes;
+
+    // Directory that file emitters write <module name>.v into. Empty
+    // means the current directory
+    std::string outputDir;
+
+    // emitVerilogHierarchy writes every module into <top name>.v instead
+    // of one file per module
+    bool hierarchyInOneFile;
+
+    // Count the cycles spent in each block that starts at a CC with a
+    // profileLabel, and the total cycles from start to done, in saturating
+    // counters read through debug_counter_addr / debug_counter_data
+    bool profileCounters;
+    int profileCounterWidth;
+
+    VerilogEmitOptions() :
+      parallelMuxes(false), outputDir(""), hierarchyInOneFile(true),
+      profileCounters(false), profileCounterWidth(32) {}
+  };
+
+  // What each address of the profile counter debug port reads. Address 0
+  // is "cycles", the total, and the rest are the profile labels of m
+  std::vector<std::string> profileCounterLabels(Module* m);
+
+  // Path the file emitters write m to
+  std::string verilogFileName(Module* m, const VerilogEmitOptions& options);
+
   void emitVerilog(Context& c, Module* m);
+  void emitVerilog(Context& c, Module* m, const VerilogEmitOptions& options);
+
+  // Emitters that never touch the filesystem. They only read m, so
+  // different modules can be emitted concurrently
+  void emitVerilog(Context& c,
+                   Module* m,
+                   std::ostream& out,
+                   const VerilogEmitOptions& options);
+  std::string emitVerilogString(Context& c,
+                                Module* m,
+                                const VerilogEmitOptions& options);
+
+  // Emits top and every non-primitive module instantiated below it, each
+  // exactly once. Modules with the same structural hash are emitted once
+  // and all their instances use the emitted copy. Every module in the
+  // hierarchy must already be lowered.
+  void emitVerilogHierarchy(Context& c, Module* top);
+  void emitVerilogHierarchy(Context& c,
+                            Module* top,
+                            const VerilogEmitOptions& options);
+  void emitVerilogHierarchy(Context& c,
+                            Module* top,
+                            std::ostream& out,
+                            const VerilogEmitOptions& options);
+
+  class PrimitiveCost {
+  public:
+    int flops;
+    int luts;
+    // LUT levels from the inputs to the outputs of a primitive without a
+    // clock
+    int delay;
+  };
+
+  // Estimated size and speed of a lowered module, as emitVerilog would
+  // build it, including every module instantiated below it
+  class ModuleEstimate {
+  public:
+    int flops;
+    int luts;
+
+    // LUT levels on the longest path between flops or module ports, and
+    // the signals along it
+    int criticalPath;
+    std::vector<std::string> criticalPathNodes;
+
+    // Primitives with no cost entry, such as memories, which are counted
+    // as zero size and as registering their ports
+    std::set<std::string> blackBoxes;
+  };
+
+  ModuleEstimate estimateModule(Module* m);
+  std::ostream& operator<<(std::ostream& out, const ModuleEstimate& est);
 
   CAC::Module* getWireMod(Context& c, const int width);
 
+  // Every port an instruction reads or writes, including its conditions
+  std::vector<Port> allReferencedPorts(CC* src);
+
   void inlineInvokes(Module* m);
   void synthesizeChannels(Module* pipeAdds);
   void reduceStructures(Module* m);
@@ -667,10 +823,38 @@ namespace CAC {
   void deleteNoEffectInstructions(Module* m);
   void deleteDeadResources(Module* m);  
 
+  // Removes activations whose condition is a constant 0 and every CC that
+  // cannot be reached from a start action, then deletes dead resources
+  void deleteUnreachableInstructions(Module* m);
+
+  // Shares one instance per constant, folds combinational primitives whose
+  // inputs are all structurally driven by constants, and simplifies
+  // activations with constant conditions
+  void foldConstants(Module* m);
+
   void bindByType(CC* invocation, ModuleInstance* toBind);
 
   Module* addComparator(Context& c, const std::string& name, const int width);
+  Module* addComparator(Context& c,
+                        const std::string& name,
+                        const std::string& verilogMod,
+                        const int width);
   
-  void addBinop(Context& c, const std::string& name, const int cycleLatency);
+  Module* addBinop(Context& c,
+                   const std::string& name,
+                   const std::string& verilogMod,
+                   const int width,
+                   const int cycleLatency);
+
+  // Width generic operators backed by builtins.v, named after the LLVM
+  // opcodes / icmp predicates they implement ("add", "mul", "ashr", "sge",
+  // "ult", ...). Modules are named <op>_<width>.
+  bool isSupportedBinop(const std::string& op);
+  int binopLatency(const std::string& op);
+
+  // Estimated combinational delay of an operator, in LUT levels
+  int operatorDelay(const std::string& op, const int width);
+  Module* getBinopMod(Context& c, const std::string& op, const int width);
+  Module* getComparatorMod(Context& c, const std::string& op, const int width);
   
 }
@@ -5,6 +5,12 @@
 #include <llvm/IR/InstrTypes.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Transforms/Scalar/LoopUnrollPass.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
 
 using namespace llvm;
 using namespace CAC;
@@ -103,77 +109,2133 @@ std::string valueString(const Value* const iptr) {
   return ss.str();
 }
 
-void addRAM32Primitive(Context& c) {
-  CAC::Module* m = c.addModule("ram_32_128");
+string binopName(BinaryOperator* const op) {
+  switch (op->getOpcode()) {
+  case Instruction::Add:
+    return "add";
+  case Instruction::Sub:
+    return "sub";
+  case Instruction::Mul:
+    return "mul";
+  case Instruction::SDiv:
+    return "sdiv";
+  case Instruction::UDiv:
+    return "udiv";
+  case Instruction::SRem:
+    return "srem";
+  case Instruction::URem:
+    return "urem";
+  case Instruction::And:
+    return "and";
+  case Instruction::Or:
+    return "or";
+  case Instruction::Xor:
+    return "xor";
+  case Instruction::Shl:
+    return "shl";
+  case Instruction::LShr:
+    return "lshr";
+  case Instruction::AShr:
+    return "ashr";
+  default:
+    cout << "Error: Unsupported binary operator " << valueString(op) << endl;
+    assert(false);
+    return "";
+  }
+}
+
+// Operators whose low n result bits depend only on the low n bits of
+// their operands
+bool wrapsModuloWidth(const std::string& op) {
+  return op == "add" || op == "sub" || op == "mul" ||
+    op == "and" || op == "or" || op == "xor";
+}
+
+bool isSignedOp(const std::string& op) {
+  return op == "ashr" || op == "sdiv" || op == "srem" ||
+    op == "sgt" || op == "sge" || op == "slt" || op == "sle";
+}
+
+// Width to build an operator at, given the widths of its operands and
+// result and the width of their LLVM type. Narrowed values are
+// non-negative, so signed operators on them need one extra bit for the
+// sign.
+int operatorWidth(const std::string& op,
+                  const int typeWidth,
+                  const int outWidth,
+                  const int in0Width,
+                  const int in1Width) {
+  if (wrapsModuloWidth(op)) {
+    return outWidth;
+  }
+
+  int width = max(outWidth, max(in0Width, in1Width));
+  if (isSignedOp(op)) {
+    width = min(typeWidth, width + 1);
+  }
+  return width;
+}
+
+string comparatorName(const llvm::CmpInst::Predicate p) {
+  switch (p) {
+  case llvm::CmpInst::ICMP_EQ:
+    return "eq";
+  case llvm::CmpInst::ICMP_NE:
+    return "ne";
+  case llvm::CmpInst::ICMP_SGT:
+    return "sgt";
+  case llvm::CmpInst::ICMP_SGE:
+    return "sge";
+  case llvm::CmpInst::ICMP_SLT:
+    return "slt";
+  case llvm::CmpInst::ICMP_SLE:
+    return "sle";
+  case llvm::CmpInst::ICMP_UGT:
+    return "ugt";
+  case llvm::CmpInst::ICMP_UGE:
+    return "uge";
+  case llvm::CmpInst::ICMP_ULT:
+    return "ult";
+  case llvm::CmpInst::ICMP_ULE:
+    return "ule";
+  default:
+    cout << "Error: Unsupported comparison predicate " << p << endl;
+    assert(false);
+    return "";
+  }
+}
+
+// A memory argument is a pointer to a struct named ram_<width>_<depth>,
+// optionally followed by _<R>r_<W>w to give the number of read and write
+// ports (default one of each). For example ram_32_128 or ram_16_64_2r_1w.
+// An argument called a gets ports a_raddr_<i>, a_rdata_<i>, a_wen_<i>,
+// a_waddr_<i> and a_wdata_<i>. Addresses are just wide enough for the
+// depth.
+class MemorySpec {
+public:
+  string name;
+  int width;
+  int depth;
+  int readPorts;
+  int writePorts;
+
+  MemorySpec() : name(""), width(0), depth(0), readPorts(0), writePorts(0) {}
+};
+
+bool parseMemoryType(const std::string& structName, MemorySpec& spec) {
+  string name = structName;
+  if (hasPrefix(name, "struct.")) {
+    name = name.substr(string("struct.").size());
+  }
+
+  // Clang may suffix a type name with .<n> when several typedefs share it
+  name = name.substr(0, name.find("."));
+
+  if (!hasPrefix(name, "ram_")) {
+    return false;
+  }
+
+  int width = 0;
+  int depth = 0;
+  int readPorts = 1;
+  int writePorts = 1;
+
+  // %n records how much of the name matched, so trailing text is rejected
+  int matched = -1;
+  sscanf(name.c_str(), "ram_%d_%d_%dr_%dw%n", &width, &depth, &readPorts, &writePorts, &matched);
+  if (matched != (int) name.size()) {
+    readPorts = 1;
+    writePorts = 1;
+    matched = -1;
+    sscanf(name.c_str(), "ram_%d_%d%n", &width, &depth, &matched);
+  }
+  if (matched != (int) name.size()) {
+    return false;
+  }
+
+  if (width <= 0 || depth <= 0 || readPorts < 0 || writePorts < 0) {
+    return false;
+  }
+
+  spec.name = name;
+  spec.width = width;
+  spec.depth = depth;
+  spec.readPorts = readPorts;
+  spec.writePorts = writePorts;
+  return true;
+}
+
+int addressWidth(const int depth) {
+  int width = 1;
+  while ((1 << width) < depth) {
+    width++;
+  }
+  return width;
+}
+
+std::string readActionName(const MemorySpec& spec, const int port) {
+  return spec.name + "_read_" + to_string(port);
+}
+
+std::string writeActionName(const MemorySpec& spec, const int port) {
+  return spec.name + "_write_" + to_string(port);
+}
+
+// A posted write completes as soon as it is issued instead of waiting for
+// the RAM to commit it. The caller must ensure no aliasing read is issued
+// before the data lands.
+std::string postedWriteActionName(const MemorySpec& spec, const int port) {
+  return writeActionName(spec, port) + "_posted";
+}
+
+// Cycles between a write being issued and a read of the same address
+// seeing the new data
+static const int writeVisibleLatency = 3;
+
+void addWriteAction(Context& c,
+                    CAC::Module* mem,
+                    const MemorySpec& spec,
+                    const int port,
+                    const std::string& actionName,
+                    const int holdCycles) {
+  string p = to_string(port);
+  string memWen = spec.name + "_wen_" + p;
+  string memWaddr = spec.name + "_waddr_" + p;
+  string memWdata = spec.name + "_wdata_" + p;
+
+  CAC::Module* write = c.addModule(actionName);
+  write->addOutPort(1, memWen);
+  write->addInPort(spec.width, memWdata);
+  write->addInPort(addressWidth(spec.depth), memWaddr);
+
+  write->addInPort(1, "wen_0");
+  write->addOutPort(addressWidth(spec.depth), "waddr_0");
+  write->addOutPort(spec.width, "wdata_0");
+
+  CC* setWen = write->addCC(write->ipt(memWen),
+                            write->ipt("wen_0"));
+  setWen->setIsStartAction(true);
+  CC* setWaddr = write->addCC(write->ipt(memWaddr),
+                              write->ipt("waddr_0"));
+  CC* setWdata = write->addCC(write->ipt(memWdata),
+                              write->ipt("wdata_0"));
+  CC* end = write->addEmpty();
+
+  setWen->then(write->c(1, 1), setWaddr, 0);
+  setWaddr->then(write->c(1, 1), setWdata, 0);
+  setWdata->then(write->c(1, 1), end, holdCycles);
+
+  mem->addAction(write);
+}
+
+CAC::Module* getMemoryMod(Context& c, const MemorySpec& spec) {
+  if (c.hasModule(spec.name)) {
+    return c.getModule(spec.name);
+  }
+
+  CAC::Module* mem = c.addModule(spec.name);
+  mem->setPrimitive(true);
+
+  for (int i = 0; i < spec.readPorts; i++) {
+    string p = to_string(i);
+    mem->addInPort(addressWidth(spec.depth), "raddr_" + p);
+    mem->addOutPort(spec.width, "rdata_" + p);
+  }
+
+  for (int i = 0; i < spec.writePorts; i++) {
+    string p = to_string(i);
+    mem->addInPort(1, "wen_" + p);
+    mem->addInPort(addressWidth(spec.depth), "waddr_" + p);
+    mem->addInPort(spec.width, "wdata_" + p);
+    mem->setDefaultValue("wen_" + p, 0);
+  }
+
+  for (int i = 0; i < spec.readPorts; i++) {
+    string p = to_string(i);
+    string memRaddr = spec.name + "_raddr_" + p;
+    string memRdata = spec.name + "_rdata_" + p;
+
+    CAC::Module* read = c.addModule(readActionName(spec, i));
+    read->addOutPort(addressWidth(spec.depth), memRaddr);
+    read->addInPort(spec.width, memRdata);
+
+    read->addInPort(addressWidth(spec.depth), "raddr_0");
+    read->addOutPort(spec.width, "rdata_0");
+
+    CC* setRaddr = read->addStartInstruction(read->ipt("raddr_0"),
+                                             read->ipt(memRaddr));
+    CC* readRdata = read->addInstruction(read->ipt("rdata_0"),
+                                         read->ipt(memRdata));
+    setRaddr->continueTo(read->c(1, 1), readRdata, 1);
+
+    mem->addAction(read);
+  }
+
+  for (int i = 0; i < spec.writePorts; i++) {
+    addWriteAction(c, mem, spec, i, writeActionName(spec, i), writeVisibleLatency);
+    addWriteAction(c, mem, spec, i, postedWriteActionName(spec, i), 0);
+  }
+
+  return mem;
+}
+
+CC* setReg(ModuleInstance* r, const int value, CAC::Module* container) {
+  auto setR =
+    container->addInvokeInstruction(r->action("st"));
+  bindByType(setR, r);
+  setR->bind("in", container->c(r->pt("in").getWidth(), value));
+  setR->bind("en", container->c(1, 1));
+
+  return setR;
+}
+
+Port notVal(const Port toNegate, CAC::Module* m) {
+  if (isConstant(toNegate)) {
+    return m->c(toNegate.getWidth(), constantValue(toNegate.inst) == 0 ? 1 : 0);
+  }
+
+  auto nm = getNotMod(*(m->getContext()), 1);
+  auto notI = m->freshInstance(nm, "not");
+  auto notAct = notI->action("apply");
+
+  auto resWire =
+    m->freshInstance(getWireMod(*(m->getContext()), toNegate.getWidth()),
+                     "not_res");
+
+  auto notActInv = m->addInvokeInstruction(notAct);
+  bindByType(notActInv, notI);
+  notActInv->bind("in", toNegate);
+  notActInv->bind("out", resWire->pt("in"));  
+
+  return resWire->pt("out");
+}
+
+// A stream argument is a pointer to a struct named stream_<width>. It is
+// an input if the function only reads it and an output if it only writes
+// it. Inputs connect to the read side of a builtins.v fifo: an argument
+// called s gets ports s_read_valid, s_read_ready and s_out_data, and the
+// data arrives the cycle after the read is issued. Outputs connect to the
+// write side, with ports s_write_valid, s_write_ready and s_in_data.
+// Accesses stall until the fifo is ready.
+class StreamSpec {
+public:
+  string name;
+  int width;
+  bool isInput;
+
+  StreamSpec() : name(""), width(0), isInput(true) {}
+};
+
+bool parseStreamType(const std::string& structName, StreamSpec& spec) {
+  string name = structName;
+  if (hasPrefix(name, "struct.")) {
+    name = name.substr(string("struct.").size());
+  }
+  name = name.substr(0, name.find("."));
+
+  if (!hasPrefix(name, "stream_")) {
+    return false;
+  }
+
+  int width = 0;
+  int matched = -1;
+  sscanf(name.c_str(), "stream_%d%n", &width, &matched);
+  if (matched != (int) name.size() || width <= 0) {
+    return false;
+  }
+
+  spec.name = name;
+  spec.width = width;
+  return true;
+}
+
+std::string streamModName(const StreamSpec& spec) {
+  return spec.name + (spec.isInput ? "_source" : "_sink");
+}
+
+std::string streamActionName(const StreamSpec& spec) {
+  return streamModName(spec) + (spec.isInput ? "_read" : "_write");
+}
+
+// Actions cannot use notVal since it emits an invoke. Instead the
+// returned CC feeds in to a not gate, and out is valid in the cycle the
+// CC runs.
+CC* negateBit(CAC::Module* act, const Port in, Port& out) {
+  ModuleInstance* n = act->freshInstance(getNotMod(*(act->getContext()), 1), "not");
+  out = n->pt("out");
+  return act->addCC(in, n->pt("in"));
+}
+
+// CC that repeats every cycle until cond is true. The caller continues
+// from it on cond.
+CC* waitUntil(CAC::Module* act, const Port cond) {
+  Port notCond;
+  CC* wait = negateBit(act, cond, notCond);
+  wait->then(notCond, wait, 1);
+  return wait;
+}
+
+// CC that repeats every cycle while busy is true. The caller continues
+// from it on notBusy.
+CC* waitWhile(CAC::Module* act, const Port busy, Port& notBusy) {
+  CC* wait = negateBit(act, busy, notBusy);
+  wait->then(busy, wait, 1);
+  return wait;
+}
+
+CAC::Module* getStreamMod(Context& c, const StreamSpec& spec) {
+  string name = streamModName(spec);
+  if (c.hasModule(name)) {
+    return c.getModule(name);
+  }
+
+  CAC::Module* stream = c.addModule(name);
+  stream->setPrimitive(true);
+
+  string valid = spec.isInput ? "read_valid" : "write_valid";
+  string ready = spec.isInput ? "read_ready" : "write_ready";
+  string data = spec.isInput ? "out_data" : "in_data";
+
+  stream->addInPort(1, valid);
+  stream->addOutPort(1, ready);
+  if (spec.isInput) {
+    stream->addOutPort(spec.width, data);
+  } else {
+    stream->addInPort(spec.width, data);
+  }
+  stream->setDefaultValue(valid, 0);
+
+  string streamValid = name + "_" + valid;
+  string streamReady = name + "_" + ready;
+  string streamData = name + "_" + data;
+
+  CAC::Module* act = c.addModule(streamActionName(spec));
+  act->addOutPort(1, streamValid);
+  act->addInPort(1, streamReady);
+
+  CC* wait = waitUntil(act, act->ipt(streamReady));
+  wait->setIsStartAction(true);
+  CC* setValid = act->addCC(act->ipt(streamValid), act->c(1, 1));
+  wait->then(act->ipt(streamReady), setValid, 0);
+
+  if (spec.isInput) {
+    act->addInPort(spec.width, streamData);
+    act->addOutPort(spec.width, "rdata_0");
+
+    CC* readData = act->addCC(act->ipt("rdata_0"), act->ipt(streamData));
+    setValid->then(act->c(1, 1), readData, 1);
+  } else {
+    act->addOutPort(spec.width, streamData);
+    act->addInPort(spec.width, "wdata_0");
+
+    CC* setData = act->addCC(act->ipt(streamData), act->ipt("wdata_0"));
+    setValid->then(act->c(1, 1), setData, 0);
+  }
+
+  stream->addAction(act);
+
+  return stream;
+}
+
+// An AXI argument is a pointer to a struct named axi_<width>, where the
+// width is a whole number of bytes. Its accesses become AXI4 bursts issued
+// by the axi_burst_read_handler and axi_burst_write_handler of builtins.v,
+// and an axi_stall_manager holds each access until the one before it has
+// finished. An argument called p gets the AXI ports of both handlers,
+// named p_m_axi_<signal>. Addresses in the kernel are word addresses.
+class AxiSpec {
+public:
+  string name;
+  int width;
+
+  AxiSpec() : name(""), width(0) {}
+};
+
+bool parseAxiType(const std::string& structName, AxiSpec& spec) {
+  string name = structName;
+  if (hasPrefix(name, "struct.")) {
+    name = name.substr(string("struct.").size());
+  }
+  name = name.substr(0, name.find("."));
+
+  if (!hasPrefix(name, "axi_")) {
+    return false;
+  }
+
+  int width = 0;
+  int matched = -1;
+  sscanf(name.c_str(), "axi_%d%n", &width, &matched);
+  if (matched != (int) name.size() ||
+      width <= 0 || (width % 8) != 0) {
+    return false;
+  }
+
+  spec.name = name;
+  spec.width = width;
+  return true;
+}
+
+// Width of the word addresses handed to the AXI handlers
+static const int axiAddrWidth = 32;
+
+// Longest burst the loader will coalesce accesses into
+static const int maxBurstBeats = 16;
+
+CAC::Module* getAxiReadHandlerMod(Context& c, const AxiSpec& spec) {
+  string name = "axi_burst_read_handler_" + to_string(spec.width);
+  if (c.hasModule(name)) {
+    return c.getModule(name);
+  }
+
+  CAC::Module* rd = c.addModule(name);
+  rd->setPrimitive(true);
+
+  rd->addInPort(1, "start_read");
+  rd->addInPort(axiAddrWidth, "read_addr");
+  rd->addInPort(8, "read_len");
+  rd->addOutPort(spec.width, "read_data");
+  rd->addOutPort(1, "valid");
+  rd->addOutPort(1, "finished");
+  rd->setDefaultValue("start_read", 0);
+
+  rd->addOutPort(1, "m_axi_arvalid");
+  rd->addInPort(1, "m_axi_arready");
+  rd->addOutPort(axiAddrWidth, "m_axi_araddr");
+  rd->addOutPort(8, "m_axi_arlen");
+  rd->addOutPort(3, "m_axi_arsize");
+  rd->addOutPort(2, "m_axi_arburst");
+  rd->addInPort(1, "m_axi_rvalid");
+  rd->addOutPort(1, "m_axi_rready");
+  rd->addInPort(spec.width, "m_axi_rdata");
+  rd->addInPort(2, "m_axi_rresp");
+  rd->addInPort(1, "m_axi_rlast");
+
+  rd->setVerilogDeclString("axi_burst_read_handler #(.DATA_WIDTH(" + to_string(spec.width) + "), .ADDR_WIDTH(" + to_string(axiAddrWidth) + "))");
+  return rd;
+}
+
+CAC::Module* getAxiWriteHandlerMod(Context& c, const AxiSpec& spec) {
+  string name = "axi_burst_write_handler_" + to_string(spec.width);
+  if (c.hasModule(name)) {
+    return c.getModule(name);
+  }
+
+  CAC::Module* wr = c.addModule(name);
+  wr->setPrimitive(true);
+
+  wr->addInPort(1, "start_write");
+  wr->addInPort(axiAddrWidth, "write_addr");
+  wr->addInPort(8, "write_len");
+  wr->addInPort(spec.width, "write_data");
+  wr->addInPort(1, "write_data_valid");
+  wr->addOutPort(1, "write_data_ready");
+  wr->addOutPort(1, "finished");
+  wr->setDefaultValue("start_write", 0);
+  wr->setDefaultValue("write_data_valid", 0);
+
+  wr->addOutPort(1, "m_axi_awvalid");
+  wr->addInPort(1, "m_axi_awready");
+  wr->addOutPort(axiAddrWidth, "m_axi_awaddr");
+  wr->addOutPort(8, "m_axi_awlen");
+  wr->addOutPort(3, "m_axi_awsize");
+  wr->addOutPort(2, "m_axi_awburst");
+  wr->addOutPort(1, "m_axi_wvalid");
+  wr->addInPort(1, "m_axi_wready");
+  wr->addOutPort(spec.width, "m_axi_wdata");
+  wr->addOutPort(spec.width / 8, "m_axi_wstrb");
+  wr->addOutPort(1, "m_axi_wlast");
+  wr->addInPort(1, "m_axi_bvalid");
+  wr->addInPort(2, "m_axi_bresp");
+  wr->addOutPort(1, "m_axi_bready");
+
+  wr->setVerilogDeclString("axi_burst_write_handler #(.DATA_WIDTH(" + to_string(spec.width) + "), .ADDR_WIDTH(" + to_string(axiAddrWidth) + "))");
+  return wr;
+}
+
+CAC::Module* getAxiStallManagerMod(Context& c) {
+  string name = "axi_stall_manager";
+  if (c.hasModule(name)) {
+    return c.getModule(name);
+  }
+
+  CAC::Module* stall = c.addModule(name);
+  stall->setPrimitive(true);
+
+  stall->addInPort(1, "start_read");
+  stall->addInPort(1, "start_write");
+  stall->addInPort(1, "read_finished");
+  stall->addInPort(1, "write_finished");
+  stall->addOutPort(1, "should_stall");
+  stall->setDefaultValue("start_read", 0);
+  stall->setDefaultValue("start_write", 0);
+
+  // Waits for every access to finish
+  CAC::Module* fence = c.addModule(name + "_fence");
+  fence->addInPort(1, name + "_should_stall");
+
+  Port notStalled;
+  CC* wait = waitWhile(fence, fence->ipt(name + "_should_stall"), notStalled);
+  wait->setIsStartAction(true);
+  wait->then(notStalled, fence->addEmpty(), 0);
+
+  stall->addAction(fence);
+
+  stall->setVerilogDeclString("axi_stall_manager");
+  return stall;
+}
+
+// Runs ccs in order in one cycle
+void chainInSameCycle(CAC::Module* act, const vector<CC*>& ccs) {
+  for (int i = 0; i < (int) ccs.size() - 1; i++) {
+    ccs[i]->continueTo(act->c(1, 1), ccs[i + 1], 0);
+  }
+}
+
+// Reads beats consecutive words starting at raddr_0 into rdata_0 through
+// rdata_<beats - 1>
+CAC::Module* getAxiRead(Context& c, const AxiSpec& spec, const int beats) {
+  CAC::Module* rd = getAxiReadHandlerMod(c, spec);
+  CAC::Module* stall = getAxiStallManagerMod(c);
+  string name = spec.name + "_read_" + to_string(beats);
+  if (c.hasModule(name)) {
+    return c.getModule(name);
+  }
+
+  string r = rd->getName() + "_";
+  string s = stall->getName() + "_";
+
+  CAC::Module* act = c.addModule(name);
+  act->addOutPort(1, r + "start_read");
+  act->addOutPort(axiAddrWidth, r + "read_addr");
+  act->addOutPort(8, r + "read_len");
+  act->addInPort(spec.width, r + "read_data");
+  act->addInPort(1, r + "valid");
+  act->addOutPort(1, s + "start_read");
+  act->addInPort(1, s + "should_stall");
+
+  act->addInPort(axiAddrWidth, "raddr_0");
+  for (int i = 0; i < beats; i++) {
+    act->addOutPort(spec.width, "rdata_" + to_string(i));
+  }
+
+  Port notStalled;
+  CC* wait = waitWhile(act, act->ipt(s + "should_stall"), notStalled);
+  wait->setIsStartAction(true);
+
+  vector<CC*> issue{act->addCC(act->ipt(r + "start_read"), act->c(1, 1)),
+      act->addCC(act->ipt(r + "read_addr"), act->ipt("raddr_0")),
+      act->addCC(act->ipt(r + "read_len"), act->c(8, beats - 1)),
+      act->addCC(act->ipt(s + "start_read"), act->c(1, 1))};
+  chainInSameCycle(act, issue);
+  wait->then(notStalled, issue[0], 0);
+
+  // The handler presents each beat for one cycle
+  CC* last = issue.back();
+  for (int i = 0; i < beats; i++) {
+    CC* beat = waitUntil(act, act->ipt(r + "valid"));
+    CC* capture = act->addCC(act->ipt("rdata_" + to_string(i)),
+                             act->ipt(r + "read_data"));
+    beat->then(act->ipt(r + "valid"), capture, 0);
+    last->then(act->c(1, 1), beat, 1);
+    last = capture;
+  }
+
+  rd->addAction(act);
+  return act;
+}
+
+// Writes wdata_0 through wdata_<beats - 1> to consecutive words starting
+// at waddr_0. The action finishes once the last beat is accepted, without
+// waiting for the write response.
+CAC::Module* getAxiWrite(Context& c, const AxiSpec& spec, const int beats) {
+  CAC::Module* wr = getAxiWriteHandlerMod(c, spec);
+  CAC::Module* stall = getAxiStallManagerMod(c);
+  string name = spec.name + "_write_" + to_string(beats);
+  if (c.hasModule(name)) {
+    return c.getModule(name);
+  }
+
+  string w = wr->getName() + "_";
+  string s = stall->getName() + "_";
+
+  CAC::Module* act = c.addModule(name);
+  act->addOutPort(1, w + "start_write");
+  act->addOutPort(axiAddrWidth, w + "write_addr");
+  act->addOutPort(8, w + "write_len");
+  act->addOutPort(spec.width, w + "write_data");
+  act->addOutPort(1, w + "write_data_valid");
+  act->addInPort(1, w + "write_data_ready");
+  act->addOutPort(1, s + "start_write");
+  act->addInPort(1, s + "should_stall");
+
+  act->addInPort(axiAddrWidth, "waddr_0");
+  for (int i = 0; i < beats; i++) {
+    act->addInPort(spec.width, "wdata_" + to_string(i));
+  }
+
+  Port notStalled;
+  CC* wait = waitWhile(act, act->ipt(s + "should_stall"), notStalled);
+  wait->setIsStartAction(true);
+
+  vector<CC*> issue{act->addCC(act->ipt(w + "start_write"), act->c(1, 1)),
+      act->addCC(act->ipt(w + "write_addr"), act->ipt("waddr_0")),
+      act->addCC(act->ipt(w + "write_len"), act->c(8, beats - 1)),
+      act->addCC(act->ipt(s + "start_write"), act->c(1, 1))};
+  chainInSameCycle(act, issue);
+  wait->then(notStalled, issue[0], 0);
+
+  // Each beat is offered until the handler accepts it
+  CC* last = issue.back();
+  Port lastAccepted = act->c(1, 1);
+  for (int i = 0; i < beats; i++) {
+    CC* setData = act->addCC(act->ipt(w + "write_data"),
+                             act->ipt("wdata_" + to_string(i)));
+    CC* setValid = act->addCC(act->ipt(w + "write_data_valid"), act->c(1, 1));
+    Port notReady;
+    CC* accept = negateBit(act, act->ipt(w + "write_data_ready"), notReady);
+    chainInSameCycle(act, {setData, setValid, accept});
+    accept->then(notReady, setData, 1);
+
+    last->then(lastAccepted, setData, 1);
+    last = accept;
+    lastAccepted = act->ipt(w + "write_data_ready");
+  }
+  last->then(lastAccepted, act->addEmpty(), 0);
+
+  wr->addAction(act);
+  return act;
+}
+
+// Accesses are calls to the builtins declared in ram.h, axi.h and
+// stream.h, whose first argument is the memory
+bool isMemoryRead(Instruction* const instr) {
+  if (!CallInst::classof(instr)) {
+    return false;
+  }
+  string name = calledFuncName(instr);
+  return name == "read" || name == "read_axi" || name == "read_stream";
+}
+
+bool isMemoryWrite(Instruction* const instr) {
+  if (!CallInst::classof(instr)) {
+    return false;
+  }
+  string name = calledFuncName(instr);
+  return name == "write" || name == "write_axi" || name == "write_stream";
+}
+
+bool isMemoryAccess(Instruction* const instr) {
+  return isMemoryRead(instr) || isMemoryWrite(instr);
+}
+
+// Name of the struct that the first operand of instr points to, or "" if
+// it does not point to a named struct
+std::string pointedToStructName(Instruction* const instr) {
+  Type* tp = instr->getOperand(0)->getType();
+  if (!PointerType::classof(tp) ||
+      !StructType::classof(getPointedToType(tp))) {
+    return "";
+  }
+
+  StructType* stp = dyn_cast<StructType>(getPointedToType(tp));
+  if (!stp->hasName()) {
+    return "";
+  }
+  return string(stp->getName());
+}
+
+bool isStreamAccess(Instruction* const instr) {
+  StreamSpec spec;
+  return isMemoryAccess(instr) &&
+    parseStreamType(pointedToStructName(instr), spec);
+}
+
+bool isAxiAccess(Instruction* const instr) {
+  AxiSpec spec;
+  return isMemoryAccess(instr) &&
+    parseAxiType(pointedToStructName(instr), spec);
+}
+
+// Calls to other functions defined in the file start a dataflow stage
+bool isStageCall(Instruction* const instr) {
+  if (!CallInst::classof(instr) ||
+      matchesCall("llvm.", instr) ||
+      isMemoryAccess(instr)) {
+    return false;
+  }
+
+  Function* callee = dyn_cast<CallInst>(instr)->getCalledFunction();
+  return callee != nullptr && !callee->isDeclaration();
+}
+
+// An address of the form scale*base + offset. Constant addresses have a
+// null base.
+class AffineAddress {
+public:
+  Value* base;
+  int scale;
+  int offset;
+
+  AffineAddress(Value* base_, const int scale_, const int offset_) :
+    base(base_), scale(scale_), offset(offset_) {}
+};
+
+AffineAddress affineAddress(Value* v) {
+  if (ConstantInt::classof(v)) {
+    return {nullptr, 0, (int) dyn_cast<ConstantInt>(v)->getSExtValue()};
+  }
+
+  if (BinaryOperator::classof(v)) {
+    BinaryOperator* op = dyn_cast<BinaryOperator>(v);
+    Value* a = op->getOperand(0);
+    Value* b = op->getOperand(1);
+
+    if (op->getOpcode() == Instruction::Add) {
+      if (ConstantInt::classof(a)) {
+        swap(a, b);
+      }
+      if (ConstantInt::classof(b)) {
+        AffineAddress addr = affineAddress(a);
+        addr.offset += dyn_cast<ConstantInt>(b)->getSExtValue();
+        return addr;
+      }
+    } else if (op->getOpcode() == Instruction::Or && ConstantInt::classof(b) &&
+               haveNoCommonBitsSet(a, b, op->getModule()->getDataLayout())) {
+      // An or that sets only bits known to be zero is an add
+      AffineAddress addr = affineAddress(a);
+      addr.offset += dyn_cast<ConstantInt>(b)->getSExtValue();
+      return addr;
+    } else if (op->getOpcode() == Instruction::Sub && ConstantInt::classof(b)) {
+      AffineAddress addr = affineAddress(a);
+      addr.offset -= dyn_cast<ConstantInt>(b)->getSExtValue();
+      return addr;
+    } else if ((op->getOpcode() == Instruction::Mul ||
+                op->getOpcode() == Instruction::Shl)) {
+      if (op->getOpcode() == Instruction::Mul && ConstantInt::classof(a)) {
+        swap(a, b);
+      }
+      if (ConstantInt::classof(b)) {
+        int k = dyn_cast<ConstantInt>(b)->getSExtValue();
+        if (op->getOpcode() == Instruction::Shl) {
+          k = 1 << k;
+        }
+        AffineAddress addr = affineAddress(a);
+        addr.scale *= k;
+        addr.offset *= k;
+        return addr;
+      }
+    }
+  }
+
+  return {v, 1, 0};
+}
+
+// Conservative test for whether two accesses in the same basic block
+// can touch the same word. Distinct memory arguments are distinct RAMs.
+bool mayAlias(Instruction* const a, Instruction* const b) {
+  if (a->getOperand(0) != b->getOperand(0)) {
+    return false;
+  }
+
+  AffineAddress aAddr = affineAddress(a->getOperand(1));
+  AffineAddress bAddr = affineAddress(b->getOperand(1));
+
+  if (aAddr.base == bAddr.base && aAddr.scale == bAddr.scale) {
+    return aAddr.offset == bAddr.offset;
+  }
+  return true;
+}
+
+int exactLog2(const int n) {
+  int l = 0;
+  while ((1 << l) < n) {
+    l++;
+  }
+  return (1 << l) == n ? l : -1;
+}
+
+int numBanks(const MemorySpec& spec, const PartitionSpec& part) {
+  return part.kind == "complete" ? spec.depth : part.factor;
+}
+
+int bankDepth(const MemorySpec& spec, const PartitionSpec& part) {
+  return spec.depth / numBanks(spec, part);
+}
+
+std::string partitionedMemoryName(const MemorySpec& spec, const PartitionSpec& part) {
+  return spec.name + "_" + part.kind + to_string(numBanks(spec, part));
+}
+
+std::string bankPortName(const int bank, const std::string& pt, const int port) {
+  return "bank" + to_string(bank) + "_" + pt + "_" + to_string(port);
+}
+
+void checkPartition(const MemorySpec& spec, const PartitionSpec& part) {
+  if (part.kind != "cyclic" && part.kind != "block" && part.kind != "complete") {
+    cout << "Error: Unknown partition kind " << part.kind << endl;
+    assert(false);
+  }
+
+  int banks = numBanks(spec, part);
+  if (banks <= 0 || exactLog2(banks) < 0 || exactLog2(spec.depth) < 0 ||
+      banks > spec.depth) {
+    cout << "Error: Cannot split " << spec.name << " into " << banks << " banks" << endl;
+    assert(false);
+  }
+}
+
+// One module whose interface is the ports of every bank
+CAC::Module* getPartitionedMemoryMod(Context& c,
+                                     const MemorySpec& spec,
+                                     const PartitionSpec& part) {
+  string name = partitionedMemoryName(spec, part);
+  if (c.hasModule(name)) {
+    return c.getModule(name);
+  }
+
+  CAC::Module* mem = c.addModule(name);
+  mem->setPrimitive(true);
+  for (int b = 0; b < numBanks(spec, part); b++) {
+    for (int i = 0; i < spec.readPorts; i++) {
+      mem->addInPort(addressWidth(bankDepth(spec, part)), bankPortName(b, "raddr", i));
+      mem->addOutPort(spec.width, bankPortName(b, "rdata", i));
+    }
+
+    for (int i = 0; i < spec.writePorts; i++) {
+      mem->addInPort(1, bankPortName(b, "wen", i));
+      mem->addInPort(addressWidth(bankDepth(spec, part)), bankPortName(b, "waddr", i));
+      mem->addInPort(spec.width, bankPortName(b, "wdata", i));
+      mem->setDefaultValue(bankPortName(b, "wen", i), 0);
+    }
+  }
+
+  return mem;
+}
+
+// The bank an address always falls in, or -1 if that depends on runtime
+// values
+int staticBank(const MemorySpec& spec, const PartitionSpec& part, const AffineAddress& addr) {
+  int banks = numBanks(spec, part);
+  if (part.kind == "block") {
+    if (addr.base == nullptr && 0 <= addr.offset && addr.offset < spec.depth) {
+      return addr.offset / bankDepth(spec, part);
+    }
+    return -1;
+  }
+
+  if (addr.base == nullptr || addr.scale % banks == 0) {
+    return ((addr.offset % banks) + banks) % banks;
+  }
+  return -1;
+}
+
+// Adds a combinational shift or mask of addr inside an action and
+// returns its output. The connects are appended to cycleZero.
+Port addrField(CAC::Module* act,
+               const Port addr,
+               const std::string& op,
+               const int amount,
+               const std::string& name,
+               vector<CC*>& cycleZero) {
+  Context& c = *(act->getContext());
+  ModuleInstance* inst = act->addInstance(getBinopMod(c, op, 32), name);
+  cycleZero.push_back(act->addCC(addr, inst->pt("in0")));
+  cycleZero.push_back(act->addCC(act->c(32, amount), inst->pt("in1")));
+  return inst->pt("out");
+}
+
+// Splits addr into the bank it selects and its address within that bank
+void decodeAddress(CAC::Module* act,
+                   const Port addr,
+                   const MemorySpec& spec,
+                   const PartitionSpec& part,
+                   Port& bank,
+                   Port& local,
+                   vector<CC*>& cycleZero) {
+  int banks = numBanks(spec, part);
+  int depth = bankDepth(spec, part);
+  if (part.kind == "block") {
+    bank = addrField(act, addr, "lshr", exactLog2(depth), "bank", cycleZero);
+    local = addrField(act, addr, "and", depth - 1, "local", cycleZero);
+  } else {
+    bank = addrField(act, addr, "and", banks - 1, "bank", cycleZero);
+    local = addrField(act, addr, "lshr", exactLog2(banks), "local", cycleZero);
+  }
+}
+
+// Condition that is true when bank holds b. Unneeded when only one bank
+// can be selected.
+Port bankSelected(CAC::Module* act, const Port bank, const int b, vector<CC*>& cycleZero) {
+  Context& c = *(act->getContext());
+  ModuleInstance* eq = act->addInstance(getComparatorMod(c, "eq", 32), "is_bank" + to_string(b));
+  cycleZero.push_back(act->addCC(bank, eq->pt("in0")));
+  cycleZero.push_back(act->addCC(act->c(32, b), eq->pt("in1")));
+  return eq->pt("out");
+}
+
+void chainInOneCycle(CAC::Module* act, const vector<CC*>& ccs) {
+  ccs[0]->setIsStartAction(true);
+  chainInSameCycle(act, ccs);
+}
+
+std::string partitionedActionName(const MemorySpec& spec,
+                                  const PartitionSpec& part,
+                                  const std::string& kind,
+                                  const int port,
+                                  const int bank) {
+  string name = partitionedMemoryName(spec, part) + "_" + kind + "_" + to_string(port);
+  return bank < 0 ? name : name + "_bank" + to_string(bank);
+}
+
+// Read through port on bank, or on whichever bank the address selects if
+// bank is -1. In the dynamic case every bank is given the local address
+// and the data from the selected bank is forwarded.
+CAC::Module* getPartitionedRead(Context& c,
+                                const MemorySpec& spec,
+                                const PartitionSpec& part,
+                                const int port,
+                                const int bank) {
+  string name = partitionedActionName(spec, part, "read", port, bank);
+  if (c.hasModule(name)) {
+    return c.getModule(name);
+  }
+
+  string memName = partitionedMemoryName(spec, part);
+  vector<int> banks;
+  for (int b = 0; b < numBanks(spec, part); b++) {
+    if (bank < 0 || b == bank) {
+      banks.push_back(b);
+    }
+  }
+
+  CAC::Module* read = c.addModule(name);
+  read->addInPort(32, "raddr_0");
+  read->addOutPort(spec.width, "rdata_0");
+  for (int b : banks) {
+    read->addOutPort(addressWidth(bankDepth(spec, part)), memName + "_" + bankPortName(b, "raddr", port));
+    read->addInPort(spec.width, memName + "_" + bankPortName(b, "rdata", port));
+  }
+
+  vector<CC*> cycleZero;
+  Port bankIdx, local;
+  decodeAddress(read, read->ipt("raddr_0"), spec, part, bankIdx, local, cycleZero);
+  for (int b : banks) {
+    cycleZero.push_back(read->addCC(local, read->ipt(memName + "_" + bankPortName(b, "raddr", port))));
+  }
+
+  map<int, Port> selected;
+  if (banks.size() > 1) {
+    for (int b : banks) {
+      selected[b] = bankSelected(read, bankIdx, b, cycleZero);
+    }
+  }
+  chainInOneCycle(read, cycleZero);
+  CC* issued = cycleZero.back();
+
+  if (banks.size() == 1) {
+    int b = banks[0];
+    CC* readRdata = read->addCC(read->ipt("rdata_0"),
+                                read->ipt(memName + "_" + bankPortName(b, "rdata", port)));
+    issued->continueTo(read->c(1, 1), readRdata, 1);
+  } else {
+    ModuleInstance* data = read->addInstance(getWireMod(c, spec.width), "data");
+    CC* readRdata = read->addCC(read->ipt("rdata_0"), data->pt("out"));
+    for (int b : banks) {
+      CC* fromBank = read->addCC(read->ipt(memName + "_" + bankPortName(b, "rdata", port)),
+                                 data->pt("in"));
+      issued->continueTo(map_find(b, selected), fromBank, 1);
+      fromBank->continueTo(read->c(1, 1), readRdata, 0);
+    }
+  }
+
+  getPartitionedMemoryMod(c, spec, part)->addAction(read);
+  return read;
+}
+
+// Write through port on bank, or on whichever bank the address selects
+// if bank is -1. In the dynamic case the write enable of each bank is
+// gated by its select.
+CAC::Module* getPartitionedWrite(Context& c,
+                                 const MemorySpec& spec,
+                                 const PartitionSpec& part,
+                                 const int port,
+                                 const int bank,
+                                 const bool posted) {
+  string name = partitionedActionName(spec, part, posted ? "write_posted" : "write", port, bank);
+  if (c.hasModule(name)) {
+    return c.getModule(name);
+  }
+
+  string memName = partitionedMemoryName(spec, part);
+  vector<int> banks;
+  for (int b = 0; b < numBanks(spec, part); b++) {
+    if (bank < 0 || b == bank) {
+      banks.push_back(b);
+    }
+  }
+
+  CAC::Module* write = c.addModule(name);
+  write->addInPort(1, "wen_0");
+  write->addInPort(32, "waddr_0");
+  write->addInPort(spec.width, "wdata_0");
+  for (int b : banks) {
+    write->addOutPort(1, memName + "_" + bankPortName(b, "wen", port));
+    write->addOutPort(addressWidth(bankDepth(spec, part)), memName + "_" + bankPortName(b, "waddr", port));
+    write->addOutPort(spec.width, memName + "_" + bankPortName(b, "wdata", port));
+  }
+
+  vector<CC*> cycleZero;
+  Port bankIdx, local;
+  decodeAddress(write, write->ipt("waddr_0"), spec, part, bankIdx, local, cycleZero);
+  for (int b : banks) {
+    Port en = banks.size() == 1 ? write->ipt("wen_0") : bankSelected(write, bankIdx, b, cycleZero);
+    cycleZero.push_back(write->addCC(en, write->ipt(memName + "_" + bankPortName(b, "wen", port))));
+    cycleZero.push_back(write->addCC(local, write->ipt(memName + "_" + bankPortName(b, "waddr", port))));
+    cycleZero.push_back(write->addCC(write->ipt("wdata_0"),
+                                     write->ipt(memName + "_" + bankPortName(b, "wdata", port))));
+  }
+  chainInOneCycle(write, cycleZero);
+
+  CC* end = write->addEmpty();
+  cycleZero.back()->continueTo(write->c(1, 1), end, posted ? 0 : writeVisibleLatency);
+
+  getPartitionedMemoryMod(c, spec, part)->addAction(write);
+  return write;
+}
+
+// The alloca that a load or store of a local variable accesses, or null
+AllocaInst* accessedAlloca(Instruction* const instr) {
+  Value* ptr = nullptr;
+  if (LoadInst::classof(instr)) {
+    ptr = dyn_cast<LoadInst>(instr)->getPointerOperand();
+  } else if (StoreInst::classof(instr)) {
+    ptr = dyn_cast<StoreInst>(instr)->getPointerOperand();
+  }
+  return ptr == nullptr ? nullptr : dyn_cast<AllocaInst>(ptr);
+}
+
+bool dependsOn(Instruction* const later, Instruction* const earlier) {
+  for (Value* op : later->operands()) {
+    if (op == earlier) {
+      return true;
+    }
+  }
+
+  // Accesses to the register of a local variable stay in source order
+  // unless both are loads
+  AllocaInst* local = accessedAlloca(later);
+  if (local != nullptr && local == accessedAlloca(earlier) &&
+      (StoreInst::classof(later) || StoreInst::classof(earlier))) {
+    return true;
+  }
+
+  // Stream accesses are not reordered, since their order is the order of
+  // the data
+  if (isStreamAccess(later) && isStreamAccess(earlier)) {
+    return true;
+  }
+
+  // Stages are started in source order
+  if (isStageCall(later) || isStageCall(earlier)) {
+    return true;
+  }
+
+  if (isMemoryAccess(later) && isMemoryAccess(earlier) &&
+      (isMemoryWrite(later) || isMemoryWrite(earlier))) {
+    return mayAlias(later, earlier);
+  }
+
+  return false;
+}
+
+// Instructions that emit nothing and so take no cycles
+bool isUntimed(Instruction* const instr) {
+  return AllocaInst::classof(instr) ||
+    BitCastInst::classof(instr) ||
+    matchesCall("llvm.", instr);
+}
+
+// Order in which to issue the instructions of a block. PHIs stay first
+// and the terminator stays last. Everything else is list scheduled over
+// the data and memory dependences in source order, except that a read
+// which does not conflict with the next pending write is issued ahead of
+// it. Reads only move past one write at a time so their values are not
+// held for long.
+vector<Instruction*> memoryAwareOrder(BasicBlock& bb) {
+  vector<Instruction*> phis;
+  vector<Instruction*> body;
+  for (auto& instrR : bb) {
+    Instruction* instr = &instrR;
+    if (PHINode::classof(instr)) {
+      phis.push_back(instr);
+    } else if (instr != bb.getTerminator()) {
+      body.push_back(instr);
+    }
+  }
+
+  vector<Instruction*> order = phis;
+  vector<bool> scheduled(body.size(), false);
+  for (int n = 0; n < (int) body.size(); n++) {
+    int next = -1;
+    for (int i = 0; i < (int) body.size(); i++) {
+      if (scheduled[i]) {
+        continue;
+      }
+
+      if (next != -1 && isMemoryWrite(body[i])) {
+        break;
+      }
+
+      bool ready = true;
+      for (int j = 0; j < i; j++) {
+        if (!scheduled[j] && dependsOn(body[i], body[j])) {
+          ready = false;
+          break;
+        }
+      }
+
+      if (!ready) {
+        continue;
+      }
+
+      if (next == -1) {
+        next = i;
+        if (!isMemoryWrite(body[i])) {
+          break;
+        }
+      } else if (isMemoryRead(body[i])) {
+        next = i;
+        break;
+      }
+    }
+
+    assert(next != -1);
+    scheduled[next] = true;
+    order.push_back(body[next]);
+  }
+
+  order.push_back(bb.getTerminator());
+  return order;
+}
+
+// Writes in the scheduled steps of a block that may be posted: no read
+// that may alias them is issued before they land, and the block does not
+// return before then. Successor blocks start at least two cycles after
+// the terminator.
+set<Instruction*> postedWrites(const vector<vector<Instruction*> >& steps) {
+  set<Instruction*> posted;
+  for (int i = 0; i < (int) steps.size(); i++) {
+    for (Instruction* w : steps[i]) {
+      if (!isMemoryWrite(w) || isStreamAccess(w)) {
+        continue;
+      }
+
+      bool safe = true;
+      int cycles = 0;
+      for (int j = i + 1; j < (int) steps.size() && safe; j++) {
+        if (all_of(steps[j].begin(), steps[j].end(), isUntimed)) {
+          continue;
+        }
+
+        // The k'th step after w is issued at least k cycles later
+        cycles++;
+        if (cycles >= writeVisibleLatency) {
+          break;
+        }
+
+        for (Instruction* r : steps[j]) {
+          if (ReturnInst::classof(r) ||
+              (isMemoryRead(r) && mayAlias(r, w))) {
+            safe = false;
+            break;
+          }
+        }
+      }
+
+      if (safe) {
+        posted.insert(w);
+      }
+    }
+  }
+  return posted;
+}
+
+// Whether addr is the word after prev
+bool isNextWord(const AffineAddress& prev, const AffineAddress& addr) {
+  return addr.base == prev.base && addr.scale == prev.scale &&
+    addr.offset == prev.offset + 1;
+}
+
+bool mayAliasAny(Instruction* const access, const vector<Instruction*>& others) {
+  for (Instruction* other : others) {
+    if (mayAlias(access, other)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Groups the AXI accesses of a block, in order, into bursts to
+// consecutive words. A read burst is issued at its first read and a write
+// burst at its last write, so their data is ready. Reads only join a
+// burst if no write they move above may alias them, and writes only if
+// no read or write they move below may alias them. The result maps the
+// access each burst is issued at to the accesses in it.
+map<Instruction*, vector<Instruction*> > axiBursts(const vector<Instruction*>& order) {
+  map<Instruction*, vector<Instruction*> > bursts;
+  set<Instruction*> grouped;
+  for (int i = 0; i < (int) order.size(); i++) {
+    Instruction* first = order[i];
+    if (!isAxiAccess(first) || elem(first, grouped)) {
+      continue;
+    }
+
+    bool isRead = isMemoryRead(first);
+    vector<Instruction*> burst{first};
+    vector<Instruction*> crossedWrites;
+    for (int j = i + 1; j < (int) order.size(); j++) {
+      if ((int) burst.size() == maxBurstBeats) {
+        break;
+      }
+
+      Instruction* next = order[j];
+      if (!isMemoryAccess(next) ||
+          next->getOperand(0) != first->getOperand(0) ||
+          elem(next, grouped)) {
+        continue;
+      }
+
+      if (isMemoryRead(next) == isRead &&
+          isNextWord(affineAddress(burst.back()->getOperand(1)),
+                     affineAddress(next->getOperand(1)))) {
+        if (isRead && mayAliasAny(next, crossedWrites)) {
+          break;
+        }
+        burst.push_back(next);
+      } else if (isMemoryWrite(next)) {
+        if (!isRead && mayAliasAny(next, burst)) {
+          break;
+        }
+        crossedWrites.push_back(next);
+      } else if (!isRead && mayAliasAny(next, burst)) {
+        break;
+      }
+    }
+
+    for (Instruction* access : burst) {
+      grouped.insert(access);
+    }
+    bursts[isRead ? burst.front() : burst.back()] = burst;
+  }
+  return bursts;
+}
+
+bool isUnrollHint(const MDOperand& op) {
+  MDNode* hint = dyn_cast<MDNode>(op);
+  return hint != nullptr && hint->getNumOperands() > 0 &&
+    MDString::classof(hint->getOperand(0)) &&
+    hasPrefix(dyn_cast<MDString>(hint->getOperand(0))->getString().str(), "llvm.loop.unroll.");
+}
+
+bool hasUnrollHint(Loop* L) {
+  MDNode* loopID = L->getLoopID();
+  if (loopID == nullptr) {
+    return false;
+  }
+
+  for (int i = 1; i < (int) loopID->getNumOperands(); i++) {
+    if (isUnrollHint(loopID->getOperand(i))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Replaces any unroll hint on L with a request to unroll it by factor,
+// or fully if factor is 0. This is the metadata #pragma unroll produces.
+void setUnrollFactor(Loop* L, const int factor) {
+  LLVMContext& ctx = L->getHeader()->getContext();
+
+  SmallVector<Metadata*, 4> ops;
+  ops.push_back(nullptr);
+  if (MDNode* oldID = L->getLoopID()) {
+    for (int i = 1; i < (int) oldID->getNumOperands(); i++) {
+      if (!isUnrollHint(oldID->getOperand(i))) {
+        ops.push_back(oldID->getOperand(i));
+      }
+    }
+  }
+
+  if (factor == 0) {
+    ops.push_back(MDNode::get(ctx, {MDString::get(ctx, "llvm.loop.unroll.full")}));
+  } else {
+    ops.push_back(MDNode::get(ctx, {MDString::get(ctx, "llvm.loop.unroll.count"),
+            ConstantAsMetadata::get(ConstantInt::get(Type::getInt32Ty(ctx), factor))}));
+  }
+
+  MDNode* loopID = MDNode::getDistinct(ctx, ops);
+  loopID->replaceOperandWith(0, loopID);
+  L->setLoopID(loopID);
+}
+
+// Unrolls the loops of f that carry an unroll request, either from the
+// source or from options, before any hardware is generated for them.
+class FunctionAnalyses {
+public:
+  LoopAnalysisManager lam;
+  FunctionAnalysisManager fam;
+  CGSCCAnalysisManager cgam;
+  ModuleAnalysisManager mam;
+  PassBuilder pb;
+
+  FunctionAnalyses() {
+    pb.registerModuleAnalyses(mam);
+    pb.registerCGSCCAnalyses(cgam);
+    pb.registerFunctionAnalyses(fam);
+    pb.registerLoopAnalyses(lam);
+    pb.crossRegisterProxies(lam, fam, cgam, mam);
+  }
+};
+
+void unrollLoops(Function* f, FunctionAnalysisManager& fam, const LLVMLoadOptions& options) {
+  LoopInfo& li = fam.getResult<LoopAnalysis>(*f);
+  string name = f->getName().str();
+  if (contains_key(name, options.unrollFactors)) {
+    int factor = map_find(name, options.unrollFactors);
+    assert(factor >= 0);
+
+    for (Loop* L : li.getLoopsInPreorder()) {
+      setUnrollFactor(L, factor);
+    }
+  }
+
+  bool requested = false;
+  for (Loop* L : li.getLoopsInPreorder()) {
+    requested = requested || hasUnrollHint(L);
+  }
+
+  // Leave the IR untouched unless some loop asks to be unrolled
+  if (!requested) {
+    return;
+  }
+
+  // Only loops with an explicit request are unrolled
+  FunctionPassManager fpm;
+  fpm.addPass(LoopUnrollPass(LoopUnrollOptions(2, true)));
+  fpm.addPass(SimplifyCFGPass());
+  fpm.run(*f, fam);
+}
+
+int bitsFor(const uint64_t maxValue) {
+  int width = 1;
+  while (width < 64 && (maxValue >> width) != 0) {
+    width++;
+  }
+  return width;
+}
+
+// Widths of the integer values of f that scalar evolution proves never
+// need all the bits of their type. Such values are non-negative, so they
+// can be zero extended back to their type wherever they are used.
+map<Value*, int> narrowedWidths(Function* f, FunctionAnalysisManager& fam) {
+  ScalarEvolution& se = fam.getResult<ScalarEvolutionAnalysis>(*f);
+
+  map<Value*, int> widths;
+  for (auto& bb : *f) {
+    for (auto& instrR : bb) {
+      Instruction* instr = &instrR;
+      Type* tp = instr->getType();
+      if (!tp->isIntegerTy() || !se.isSCEVable(tp)) {
+        continue;
+      }
+
+      ConstantRange range = se.getUnsignedRange(se.getSCEV(instr));
+      int width = bitsFor(range.getUnsignedMax().getLimitedValue());
+      if (width < getTypeBitWidth(tp)) {
+        cout << "Narrowing " << valueString(instr) << " to " << width << " bits" << endl;
+        widths[instr] = width;
+      }
+    }
+  }
+  return widths;
+}
+
+// Whether the function, or a stage it passes arg to, writes to the stream
+// argument arg. Reading and writing the same stream is not supported.
+bool isWrittenStream(Argument& arg) {
+  bool read = false;
+  bool written = false;
+  for (User* user : arg.users()) {
+    if (!Instruction::classof(user)) {
+      continue;
+    }
+
+    Instruction* instr = dyn_cast<Instruction>(user);
+    if (isStreamAccess(instr)) {
+      read = read || isMemoryRead(instr);
+      written = written || isMemoryWrite(instr);
+    } else if (isStageCall(instr)) {
+      CallInst* call = dyn_cast<CallInst>(instr);
+      for (int i = 0; i < (int) call->arg_size(); i++) {
+        if (call->getArgOperand(i) == &arg) {
+          bool stageWrites = isWrittenStream(*(call->getCalledFunction()->getArg(i)));
+          read = read || !stageWrites;
+          written = written || stageWrites;
+        }
+      }
+    }
+  }
+
+  if (read && written) {
+    cout << "Error: Stream " << string(arg.getName()) << " is both read and written" << endl;
+    assert(false);
+  }
+  return written;
+}
+
+// The handlers behind an AXI argument
+class AxiMaster {
+public:
+  AxiSpec spec;
+  ModuleInstance* reader;
+  ModuleInstance* writer;
+  ModuleInstance* stall;
+
+  AxiMaster() : reader(nullptr), writer(nullptr), stall(nullptr) {}
+};
+
+// Instantiates the handlers for the AXI argument argName in m and exposes
+// their AXI ports as ports of m
+AxiMaster addAxiMaster(CAC::Module* m, const AxiSpec& spec, const std::string& argName) {
+  Context& c = *(m->getContext());
+
+  AxiMaster master;
+  master.spec = spec;
+  master.reader = m->freshInstanceSeq(getAxiReadHandlerMod(c, spec), argName + "_axi_read");
+  master.writer = m->freshInstanceSeq(getAxiWriteHandlerMod(c, spec), argName + "_axi_write");
+  master.stall = m->freshInstanceSeq(getAxiStallManagerMod(c), argName + "_axi_stall");
+
+  for (ModuleInstance* handler : {master.reader, master.writer}) {
+    for (Port pt : handler->source->getInterfacePorts()) {
+      if (!hasPrefix(pt.getName(), "m_axi_")) {
+        continue;
+      }
+
+      string ptName = argName + "_" + pt.getName();
+      if (pt.isInput) {
+        m->addInPort(pt.getWidth(), ptName);
+        m->addSC(handler->pt(pt.getName()), m->ipt(ptName));
+      } else {
+        m->addOutPort(pt.getWidth(), ptName);
+        m->addSC(m->ipt(ptName), handler->pt(pt.getName()));
+      }
+    }
+  }
+
+  m->addSC(master.stall->pt("read_finished"), master.reader->pt("finished"));
+  m->addSC(master.stall->pt("write_finished"), master.writer->pt("finished"));
+
+  return master;
+}
+
+// Binds the ports of the action invoked by cc that are named after the
+// module of inst to the ports of inst
+void bindToInstance(CC* cc, ModuleInstance* inst) {
+  string prefix = inst->source->getName() + "_";
+  for (Port pt : cc->invokedModule()->getInterfacePorts()) {
+    if (hasPrefix(pt.getName(), prefix)) {
+      cc->bind(pt.getName(), inst->pt(pt.getName().substr(prefix.size())));
+    }
+  }
+}
+
+// A stream allocated by a function is a fifo of builtins.v between the
+// stages that the function passes it to
+CAC::Module* getFifoMod(Context& c, const int width, const int depth) {
+  string name = "fifo_" + to_string(width) + "_" + to_string(depth);
+  if (c.hasModule(name)) {
+    return c.getModule(name);
+  }
+
+  CAC::Module* fifo = c.addModule(name);
+  fifo->setPrimitive(true);
+
+  fifo->addInPort(1, "read_valid");
+  fifo->addOutPort(1, "read_ready");
+  fifo->addInPort(1, "write_valid");
+  fifo->addOutPort(1, "write_ready");
+  fifo->addInPort(width, "in_data");
+  fifo->addOutPort(width, "out_data");
+
+  fifo->setVerilogDeclString("fifo #(.WIDTH(" + to_string(width) + "), .DEPTH(" + to_string(depth) + "))");
+  return fifo;
+}
+
+// Starts the stage once it is ready. The stage runs on its own after the
+// cycle that start is raised in.
+CAC::Module* getStageStart(Context& c, CAC::Module* stage) {
+  string name = stage->getName() + "_start";
+  if (c.hasModule(name)) {
+    return c.getModule(name);
+  }
+
+  CAC::Module* act = c.addModule(name);
+  act->addInPort(1, stage->getName() + "_ready");
+  act->addOutPort(1, stage->getName() + "_start");
+
+  CC* wait = waitUntil(act, act->ipt(stage->getName() + "_ready"));
+  wait->setIsStartAction(true);
+  CC* start = act->addCC(act->ipt(stage->getName() + "_start"), act->c(1, 1));
+  wait->then(act->ipt(stage->getName() + "_ready"), start, 0);
+
+  stage->addAction(act);
+  return act;
+}
+
+// Waits for a started stage to finish
+CAC::Module* getStageJoin(Context& c, CAC::Module* stage) {
+  string name = stage->getName() + "_join";
+  if (c.hasModule(name)) {
+    return c.getModule(name);
+  }
+
+  CAC::Module* act = c.addModule(name);
+  act->addInPort(1, stage->getName() + "_done");
+
+  CC* wait = waitUntil(act, act->ipt(stage->getName() + "_done"));
+  wait->setIsStartAction(true);
+  wait->then(act->ipt(stage->getName() + "_done"), act->addEmpty(), 0);
+
+  stage->addAction(act);
+  return act;
+}
+
+// Maybe better way to translate LLVM?
+//  1. Create channels for all non-pointer values
+//  2. Create registers for all pointers to non-builtins
+
+class CodeGenState {
+public:
+  CAC::Module* m;
+  map<AllocaInst*, ModuleInstance*> registersForAllocas;
+  map<PHINode*, ModuleInstance*> registersForPhis;
+  map<Value*, int> valueWidths;
+  map<Value*, ModuleInstance*> channelsForValues;  
+  map<Argument*, vector<Port> > portsForArgs;
+  map<Argument*, MemorySpec> memoriesForArgs;
+  map<Argument*, PartitionSpec> partitionsForArgs;
+  map<Argument*, StreamSpec> streamsForArgs;
+  map<Argument*, AxiMaster> axiForArgs;
+  map<AllocaInst*, ModuleInstance*> fifosForAllocas;
+  map<Instruction*, ModuleInstance*> stagesForCalls;
+  vector<ModuleInstance*> stages;
+  map<Value*, set<bool> > stageUses;
+  map<string, int> unitLimits;
+  map<CAC::Module*, vector<ModuleInstance*> > unitPools;
+  map<CAC::Module*, int> unitsBound;
+  map<ModuleInstance*, int> unitSteps;
+  map<string, int> resourceLimits;
+  bool narrowWidths;
+  int chainDelay;
+  int step;
+
+  CodeGenState() : m(nullptr), narrowWidths(false), chainDelay(0), step(0) {}
+  map<Argument*, int> nextReadPort;
+  map<Argument*, int> nextWritePort;
+  map<BasicBlock*, CC*> blockStarts;
+
+  CC* blockStart(BasicBlock* blk) {
+    assert(contains_key(blk, blockStarts));
+    return map_find(blk, blockStarts);
+  }
+
+  // Width of the hardware that holds v
+  int width(Value* v) {
+    if (ConstantInt::classof(v)) {
+      ConstantInt* vc = dyn_cast<ConstantInt>(v);
+      if (!narrowWidths || vc->isNegative()) {
+        return getTypeBitWidth(v->getType());
+      }
+      return bitsFor(vc->getValue().getLimitedValue());
+    }
+
+    if (contains_key(v, valueWidths)) {
+      return map_find(v, valueWidths);
+    }
+    return getTypeBitWidth(v->getType());
+  }
+
+  ModuleInstance* getChannel(Value* v) {
+    if (ConstantInt::classof(v)) {
+      int width = this->width(v);
+      ConstantInt* vc = dyn_cast<ConstantInt>(v);
+      int iVal = vc->getValue().getLimitedValue();
+      
+      //return m->c(width, iVal);
+      CAC::Module* cm = getConstMod(*(m->getContext()), width, iVal);
+      return m->freshInstance(cm, "v_const");
+    }
+
+    cout << "Getting channel for " << valueString(v) << endl;
+    assert(contains_key(v, channelsForValues));
+    auto c = map_find(v, channelsForValues);
+    cout << "Got channel" << endl;
+    return c;
+  }
+  ModuleInstance* getPhiReg(PHINode* phi) {
+    assert(contains_key(phi, registersForPhis));
+    return map_find(phi, registersForPhis);
+  }
+
+  // The CC to branch to when control moves from pred to succ. If succ
+  // starts with PHI nodes this is a CC on that edge only. It stores each
+  // PHI's incoming value into the PHI's register and then enters succ one
+  // cycle later. All the stores happen in the same cycle, so a PHI that
+  // reads another PHI of succ sees the old value, as SSA semantics need.
+  CC* edgeTo(BasicBlock* pred, BasicBlock* succ) {
+    if (succ->phis().empty()) {
+      return nullptr;
+    }
+
+    CC* edge = m->addEmpty();
+    for (PHINode& phi : succ->phis()) {
+      Value* incoming = phi.getIncomingValueForBlock(pred);
+      if (!ConstantInt::classof(incoming) &&
+          !contains_key(incoming, channelsForValues)) {
+        cout << "Error: Unsupported PHI incoming value " << valueString(incoming) << endl;
+        assert(false);
+      }
+
+      ModuleInstance* reg = getPhiReg(&phi);
+      CC* move = m->addInvokeInstruction(reg->action("st"));
+      bindByType(move, reg);
+      move->bind("in", getChannel(incoming)->pt("out"));
+      move->bind("en", m->c(1, 1));
+      edge->continueTo(m->c(1, 1), move, 0);
+    }
+    edge->continueTo(m->c(1, 1), blockStart(succ), 1);
+
+    return edge;
+  }
+
+  // Branch from the CC br to succ when cond is true
+  void branchTo(CC* br, Port cond, BasicBlock* pred, BasicBlock* succ) {
+    CC* edge = edgeTo(pred, succ);
+    if (edge == nullptr) {
+      br->continueTo(cond, blockStart(succ), 1);
+    } else {
+      br->continueTo(cond, edge, 0);
+    }
+  }
+
+  Argument* streamArg(Instruction* call) {
+    Value* ptr = call->getOperand(0);
+    if (!Argument::classof(ptr) ||
+        !contains_key(dyn_cast<Argument>(ptr), streamsForArgs)) {
+      return nullptr;
+    }
+    return dyn_cast<Argument>(ptr);
+  }
+
+  Argument* axiArg(Instruction* call) {
+    Value* ptr = call->getOperand(0);
+    if (!Argument::classof(ptr) ||
+        !contains_key(dyn_cast<Argument>(ptr), axiForArgs)) {
+      return nullptr;
+    }
+    return dyn_cast<Argument>(ptr);
+  }
+
+  Argument* memoryArg(Instruction* call) {
+    Value* ptr = call->getOperand(0);
+    if (!Argument::classof(ptr) ||
+        !contains_key(dyn_cast<Argument>(ptr), memoriesForArgs)) {
+      cout << "Error: Memory access " << valueString(call) << " is not to a memory argument" << endl;
+      assert(false);
+    }
+    return dyn_cast<Argument>(ptr);
+  }
+
+  // Accesses to the same memory are spread over its ports round robin
+  int allocatePort(Argument* arg, map<Argument*, int>& nextPort, const int numPorts) {
+    if (numPorts == 0) {
+      cout << "Error: Memory " << string(arg->getName()) << " has no port for this access" << endl;
+      assert(false);
+    }
+
+    int port = nextPort[arg];
+    nextPort[arg] = (port + 1) % numPorts;
+    return port;
+  }
+
+  // Operators with a limit are built at the width of their type, so that
+  // operations narrowed to different widths can share them
+  int unitWidth(const std::string& op, const int typeWidth, const int width) {
+    return contains_key(op, unitLimits) ? typeWidth : width;
+  }
+
+  int unitLimit(const std::string& op) {
+    int limit = contains_key(op, unitLimits) ? map_find(op, unitLimits) : -1;
+    if (limit == 0) {
+      cout << "Error: Operator " << op << " has a limit of 0 units" << endl;
+      assert(false);
+    }
+    return limit;
+  }
 
-  CAC::Module* rd = c.addModule("ram_32_128_read");
-  CAC::Module* wr = c.addModule("ram_32_128_write");
+  // Instance of opMod to compute an operator named op with in the current
+  // step. Operators with a limit share their instances round robin. Only
+  // operators in the same step run in the same cycle, and the scheduler
+  // keeps those within the limit, so a free instance always exists. The
+  // controllers for the inputs of a shared instance become its muxes.
+  ModuleInstance* bindUnit(CAC::Module* opMod, const std::string& op) {
+    vector<ModuleInstance*>& pool = unitPools[opMod];
+    int limit = unitLimit(op);
+
+    int n = unitsBound[opMod]++;
+    if (limit > 0 && (int) pool.size() == limit) {
+      for (int i = 0; i < limit; i++) {
+        ModuleInstance* unit = pool[(n + i) % limit];
+        if (map_find(unit, unitSteps) != step) {
+          cout << "Sharing " << unit->getName() << endl;
+          unitSteps[unit] = step;
+          return unit;
+        }
+      }
 
-  m->addAction(rd);
-  m->addAction(wr);  
-}
+      cout << "Error: No free " << op << " unit in step " << step << endl;
+      assert(false);
+    }
 
-CC* setReg(ModuleInstance* r, const int value, CAC::Module* container) {
-  auto setR =
-    container->addInvokeInstruction(r->action("st"));
-  bindByType(setR, r);
-  setR->bind("in", container->c(r->pt("in").getWidth(), value));
-  setR->bind("en", container->c(1, 1));
+    ModuleInstance* unit = opMod->hasPort("clk") ?
+      m->freshInstanceSeq(opMod, op) : m->freshInstance(opMod, op);
+    pool.push_back(unit);
+    unitSteps[unit] = step;
+    return unit;
+  }
 
-  return setR;
-}
+  string operatorName(Instruction* instr) {
+    if (CmpInst::classof(instr)) {
+      return comparatorName(dyn_cast<CmpInst>(instr)->getPredicate());
+    }
+    return binopName(dyn_cast<BinaryOperator>(instr));
+  }
 
-Port notVal(const Port toNegate, CAC::Module* m) {
-  auto nm = getNotMod(*(m->getContext()), 1);
-  auto notI = m->freshInstance(nm, "not");
-  auto notAct = notI->action("apply");
+  // Primitive that computes the binary operator or comparison instr
+  CAC::Module* operatorMod(Instruction* instr) {
+    Context& c = *(m->getContext());
+    string name = operatorName(instr);
+    Value* v0 = instr->getOperand(0);
+    Value* v1 = instr->getOperand(1);
+
+    if (CmpInst::classof(instr)) {
+      int typeWidth = getTypeBitWidth(v0->getType());
+      int w = operatorWidth(name, typeWidth, 1, width(v0), width(v1));
+      return getComparatorMod(c, name, unitWidth(name, typeWidth, w));
+    }
 
-  auto resWire =
-    m->freshInstance(getWireMod(*(m->getContext()), toNegate.getWidth()),
-                     "not_res");
+    int typeWidth = getTypeBitWidth(instr->getType());
+    int w = operatorWidth(name, typeWidth, width(instr), width(v0), width(v1));
+    return getBinopMod(c, name, unitWidth(name, typeWidth, w));
+  }
 
-  auto notActInv = m->addInvokeInstruction(notAct);
-  bindByType(notActInv, notI);
-  notActInv->bind("in", toNegate);
-  notActInv->bind("out", resWire->pt("in"));  
+  // Instructions that compute a value in the cycle they start, which
+  // later operators in that cycle can use
+  bool isChainable(Instruction* instr) {
+    return LoadInst::classof(instr) ||
+      PHINode::classof(instr) ||
+      CmpInst::classof(instr) ||
+      (BinaryOperator::classof(instr) && !operatorMod(instr)->hasPort("clk"));
+  }
 
-  return resWire->pt("out");
-}
+  int chainedDelay(Instruction* instr) {
+    if (!BinaryOperator::classof(instr) && !CmpInst::classof(instr)) {
+      return 0;
+    }
+    return operatorDelay(operatorName(instr), operatorMod(instr)->ept("in0").getWidth());
+  }
 
-// Maybe better way to translate LLVM?
-//  1. Create channels for all non-pointer values
-//  2. Create registers for all pointers to non-builtins
+  // The delay that chains may build up to in f
+  int chainLimit(Function* f) {
+    if (chainDelay >= 0) {
+      return chainDelay;
+    }
 
-class CodeGenState {
-public:
-  CAC::Module* m;
-  map<AllocaInst*, ModuleInstance*> registersForAllocas;
-  map<Value*, ModuleInstance*> channelsForValues;  
-  map<Argument*, vector<Port> > portsForArgs;
-  map<BasicBlock*, CC*> blockStarts;
+    int slowest = 0;
+    for (auto& bb : *f) {
+      for (auto& instr : bb) {
+        if (BinaryOperator::classof(&instr) || CmpInst::classof(&instr)) {
+          slowest = max(slowest, chainedDelay(&instr));
+        }
+      }
+    }
+    return slowest;
+  }
 
-  CC* blockStart(BasicBlock* blk) {
-    assert(contains_key(blk, blockStarts));
-    return map_find(blk, blockStarts);
+  // Access to a memory argument that is not partitioned
+  bool isPlainMemoryAccess(Instruction* instr) {
+    if (!isMemoryAccess(instr) || !Argument::classof(instr->getOperand(0))) {
+      return false;
+    }
+
+    Argument* arg = dyn_cast<Argument>(instr->getOperand(0));
+    return contains_key(arg, memoriesForArgs) &&
+      !contains_key(arg, partitionsForArgs);
   }
 
-  ModuleInstance* getChannel(Value* v) {
-    if (ConstantInt::classof(v)) {
-      int width = getTypeBitWidth(v->getType());
-      ConstantInt* vc = dyn_cast<ConstantInt>(v);
-      int iVal = vc->getValue().getLimitedValue();
-      
-      //return m->c(width, iVal);
-      CAC::Module* cm = getConstMod(*(m->getContext()), width, iVal);
-      return m->freshInstance(cm, "v_const");
+  // Cycles from instr starting until its last CC ends, or -1 if that is
+  // not known statically
+  int latency(Instruction* instr, const set<Instruction*>& posted) {
+    if (LoadInst::classof(instr) ||
+        PHINode::classof(instr) ||
+        CmpInst::classof(instr)) {
+      return 0;
     }
 
-    cout << "Getting channel for " << valueString(v) << endl;
-    assert(contains_key(v, channelsForValues));
-    auto c = map_find(v, channelsForValues);
-    cout << "Got channel" << endl;
-    return c;
+    if (BinaryOperator::classof(instr)) {
+      return operatorMod(instr)->hasPort("clk") ? -1 : 0;
+    }
+
+    if (isPlainMemoryAccess(instr)) {
+      if (isMemoryRead(instr)) {
+        return 1;
+      }
+      return elem(instr, posted) ? 0 : writeVisibleLatency;
+    }
+
+    return -1;
+  }
+
+  // Resource that instr holds in the cycle it starts, or "" for none
+  string resourceType(Instruction* instr) {
+    if (BinaryOperator::classof(instr) || CmpInst::classof(instr)) {
+      return operatorMod(instr)->getName();
+    }
+
+    if (isPlainMemoryAccess(instr)) {
+      MemorySpec spec = map_find(dyn_cast<Argument>(instr->getOperand(0)), memoriesForArgs);
+      return spec.name + (isMemoryRead(instr) ? "_read" : "_write");
+    }
+
+    return "";
+  }
+
+  // Most instructions that may hold the resource of instr in one step, or
+  // -1 for no limit. Memories are limited by their ports, and operators by
+  // their unit limit as well.
+  int resourceLimit(Instruction* instr) {
+    string type = resourceType(instr);
+    int limit = -1;
+    for (auto lim : resourceLimits) {
+      string pattern = lim.first;
+      if (pattern == type ||
+          (pattern.back() == '*' && hasPrefix(type, pattern.substr(0, pattern.size() - 1)))) {
+        limit = limit < 0 ? lim.second : min(limit, lim.second);
+      }
+    }
+
+    int cap = -1;
+    if (isPlainMemoryAccess(instr)) {
+      MemorySpec spec = map_find(dyn_cast<Argument>(instr->getOperand(0)), memoriesForArgs);
+      cap = isMemoryRead(instr) ? spec.readPorts : spec.writePorts;
+    } else if (BinaryOperator::classof(instr) || CmpInst::classof(instr)) {
+      cap = unitLimit(operatorName(instr));
+    }
+
+    if (cap >= 0) {
+      limit = limit < 0 ? cap : min(limit, cap);
+    }
+
+    if (limit == 0) {
+      cout << "Error: Resource " << type << " has a limit of 0" << endl;
+      assert(false);
+    }
+    return limit;
+  }
+
+  // Groups the instructions of a block into steps whose instructions start
+  // in the same cycle. Each step starts the cycle after the one before it
+  // ends. Steps are filled in list order with every ready instruction of
+  // known latency that has a free resource. An instruction of unknown
+  // latency runs in a step of its own. Operators may use values computed
+  // in the same step as long as the chain's delay stays within chainLimit.
+  // Without list scheduling each step holds one instruction of order.
+  vector<vector<Instruction*> > scheduleBlock(const vector<Instruction*>& order,
+                                             const map<Instruction*, vector<Instruction*> >& bursts,
+                                             const bool listSchedule,
+                                             const int chainLimit) {
+    vector<vector<Instruction*> > steps;
+    if (!listSchedule) {
+      for (Instruction* instr : order) {
+        steps.push_back({instr});
+      }
+      return steps;
+    }
+
+    // Accesses in an AXI burst happen when the burst is issued
+    map<Instruction*, Instruction*> burstIssuers;
+    for (auto burst : bursts) {
+      for (Instruction* access : burst.second) {
+        burstIssuers[access] = burst.first;
+      }
+    }
+
+    auto mustFollow = [&burstIssuers](Instruction* later, Instruction* earlier) {
+      if (dependsOn(later, earlier) || later->isTerminator()) {
+        return true;
+      }
+
+      if (contains_key(later, burstIssuers) && contains_key(earlier, burstIssuers) &&
+          map_find(later, burstIssuers) == map_find(earlier, burstIssuers)) {
+        Instruction* issuer = map_find(later, burstIssuers);
+        return later == issuer || earlier == issuer;
+      }
+      return false;
+    };
+
+    vector<bool> scheduled(order.size(), false);
+    int left = order.size();
+    while (left > 0) {
+      vector<int> picked;
+      map<string, int> used;
+      map<Instruction*, int> arrivals;
+      bool timed = false;
+      bool closed = false;
+      for (int i = 0; i < (int) order.size() && !closed; i++) {
+        Instruction* instr = order[i];
+        if (scheduled[i]) {
+          continue;
+        }
+
+        bool ready = true;
+        bool chained = false;
+        int arrival = 0;
+        for (int j = 0; j < i; j++) {
+          if (scheduled[j] || !mustFollow(instr, order[j])) {
+            continue;
+          }
+
+          if (contains_key(order[j], arrivals) &&
+              latency(instr, {}) == 0 && isChainable(instr)) {
+            chained = true;
+            arrival = max(arrival, map_find(order[j], arrivals));
+            continue;
+          }
+
+          ready = false;
+          break;
+        }
+
+        arrival += isChainable(instr) ? chainedDelay(instr) : 0;
+        if (!ready || (chained && arrival > chainLimit)) {
+          continue;
+        }
+
+        if (isUntimed(instr) ||
+            (isAxiAccess(instr) && !contains_key(instr, bursts))) {
+          picked.push_back(i);
+          continue;
+        }
+
+        if (latency(instr, {}) < 0) {
+          if (timed) {
+            continue;
+          }
+          closed = true;
+        } else {
+          // Each memory argument is limited on its own
+          string type = resourceType(instr);
+          if (isPlainMemoryAccess(instr)) {
+            type = string(instr->getOperand(0)->getName()) + "." + type;
+          }
+
+          if (type != "") {
+            int limit = resourceLimit(instr);
+            if (limit > 0 && used[type] == limit) {
+              continue;
+            }
+            used[type]++;
+          }
+        }
+
+        timed = true;
+        picked.push_back(i);
+        if (isChainable(instr)) {
+          arrivals[instr] = arrival;
+        }
+      }
+
+      assert(picked.size() > 0);
+
+      cout << "Step " << steps.size() << endl;
+      vector<Instruction*> step;
+      for (int i : picked) {
+        cout << "\t" << valueString(order[i]) << endl;
+        scheduled[i] = true;
+        step.push_back(order[i]);
+        left--;
+      }
+      steps.push_back(step);
+    }
+    return steps;
+  }
+
+  Port argPort(Argument* arg, const std::string& ptName) {
+    return m->ipt(string(arg->getName()) + "_" + ptName);
+  }
+
+  // Wires the ports that stage has for its parameter param to v, which is
+  // either an argument of this function or a stream it allocates. A local
+  // stream has one writing and one reading stage, anything else is used by
+  // one stage only.
+  void connectStageArg(ModuleInstance* stage, Argument* param, Value* v) {
+    ModuleInstance* fifo = nullptr;
+    if (AllocaInst::classof(v) &&
+        contains_key(dyn_cast<AllocaInst>(v), fifosForAllocas)) {
+      fifo = map_find(dyn_cast<AllocaInst>(v), fifosForAllocas);
+    } else if (!Argument::classof(v) ||
+               !contains_key(dyn_cast<Argument>(v), portsForArgs)) {
+      cout << "Error: Unsupported argument " << valueString(v) << " to stage " << stage->source->getName() << endl;
+      assert(false);
+    }
+
+    bool writes = fifo != nullptr && isWrittenStream(*param);
+    if (elem(writes, stageUses[v]) ||
+        (fifo == nullptr && stageUses[v].size() > 0)) {
+      cout << "Error: " << valueString(v) << " is used by more than one stage" << endl;
+      assert(false);
+    }
+    stageUses[v].insert(writes);
+
+    string prefix = string(param->getName()) + "_";
+    for (Port pt : stage->source->getInterfacePorts()) {
+      if (!hasPrefix(pt.getName(), prefix)) {
+        continue;
+      }
+
+      string suffix = pt.getName().substr(prefix.size());
+      Port outer;
+      if (fifo != nullptr) {
+        if (suffix == "clk" || suffix == "rst" || !fifo->source->hasPort(suffix)) {
+          continue;
+        }
+        outer = fifo->pt(suffix);
+      } else {
+        string ptName = string(v->getName()) + "_" + suffix;
+        if (!m->hasPort(ptName)) {
+          continue;
+        }
+        outer = m->ipt(ptName);
+      }
+
+      if (pt.isInput) {
+        m->addSC(stage->pt(pt.getName()), outer);
+      } else {
+        m->addSC(outer, stage->pt(pt.getName()));
+      }
+    }
   }
+
   ModuleInstance* getReg(Value* targetReg) {
     assert(AllocaInst::classof(targetReg));
     assert(contains_key(dyn_cast<AllocaInst>(targetReg), registersForAllocas));
@@ -188,78 +2250,74 @@ public:
 void loadLLVMFromFile(Context& c,
                       const std::string& topFunction,
                       const std::string& filePath) {
+  loadLLVMFromFile(c, topFunction, filePath, LLVMLoadOptions());
+}
 
+// At -O0 clang spills every argument to an alloca and loads it back at
+// each use. Memory accesses need the memory argument itself, so loads of
+// an alloca whose only store is of a pointer argument are replaced by
+// that argument.
+void forwardSpilledArguments(Function* f) {
+  vector<AllocaInst*> allocas;
+  for (auto& instr : f->getEntryBlock()) {
+    if (AllocaInst::classof(&instr)) {
+      allocas.push_back(dyn_cast<AllocaInst>(&instr));
+    }
+  }
 
-  
-  map<string, CAC::Module*> builtinModDefs;
-  CAC::Module* ram32_128 = c.addModule("ram32_128");
-  ram32_128->setPrimitive(true);
-  ram32_128->addInPort(32, "raddr_0");
-  ram32_128->addOutPort(32, "rdata_0");
-  ram32_128->addInPort(1, "wen_0");  
-  ram32_128->addInPort(32, "waddr_0");
-  ram32_128->addInPort(32, "wdata_0");
-  ram32_128->setDefaultValue("wen_0", 0);
-
-  CAC::Module* read = c.addModule("ram32_128_read");
-  read->addOutPort(32, "ram32_128_raddr_0");
-  read->addInPort(32, "ram32_128_rdata_0");  
-
-  read->addInPort(32, "raddr_0");
-  read->addOutPort(32, "rdata_0");  
-
-  CC* setRaddr = read->addStartInstruction(read->ipt("raddr_0"),
-                                           read->ipt("ram32_128_raddr_0"));
-  CC* readRdata = read->addInstruction(read->ipt("rdata_0"),
-                                       read->ipt("ram32_128_rdata_0"));
-  setRaddr->continueTo(read->c(1, 1), readRdata, 1);
-  
-  CAC::Module* write = c.addModule("ram32_128_write");
-  write->addOutPort(1, "ram32_128_wen_0");
-  write->addInPort(32, "ram32_128_wdata_0");  
-  write->addInPort(32, "ram32_128_waddr_0");
-  
-  write->addInPort(1, "wen_0");
-  write->addOutPort(32, "waddr_0");  
-  write->addOutPort(32, "wdata_0");
+  for (AllocaInst* alloca : allocas) {
+    StoreInst* spill = nullptr;
+    vector<LoadInst*> reloads;
+    bool onlySpilled = true;
+    for (User* user : alloca->users()) {
+      if (StoreInst::classof(user) && spill == nullptr &&
+          dyn_cast<StoreInst>(user)->getPointerOperand() == alloca) {
+        spill = dyn_cast<StoreInst>(user);
+      } else if (LoadInst::classof(user)) {
+        reloads.push_back(dyn_cast<LoadInst>(user));
+      } else {
+        onlySpilled = false;
+      }
+    }
 
-  CC* setWen = write->addCC(write->ipt("ram32_128_wen_0"),
-                            write->ipt("wen_0"));
-  setWen->setIsStartAction(true);
-  CC* setWaddr = write->addCC(write->ipt("ram32_128_waddr_0"),
-                              write->ipt("waddr_0"));
-  CC* setWdata = write->addCC(write->ipt("ram32_128_wdata_0"),
-                              write->ipt("wdata_0"));
-  CC* end = write->addEmpty();
-  
-  setWen->then(write->c(1, 1), setWaddr, 0);
-  setWaddr->then(write->c(1, 1), setWdata, 0);
-  setWdata->then(write->c(1, 1), end, 3);
+    if (!onlySpilled || spill == nullptr ||
+        !Argument::classof(spill->getValueOperand()) ||
+        !spill->getValueOperand()->getType()->isPointerTy()) {
+      continue;
+    }
 
-  ram32_128->addAction(read);
-  ram32_128->addAction(write);
-  
-  builtinModDefs["struct.ram_32_128"] = ram32_128;
-  builtinModDefs["read"] = read;
-  builtinModDefs["write"] = write;
-  
-  SMDiagnostic err;
-  LLVMContext context;
+    for (LoadInst* reload : reloads) {
+      reload->replaceAllUsesWith(spill->getValueOperand());
+      reload->eraseFromParent();
+    }
+    spill->eraseFromParent();
+    alloca->eraseFromParent();
+  }
+}
 
-  std::unique_ptr<llvm::Module> mod(parseIRFile(filePath, err, context));
-  if (!mod) {
-    outs() << "Error: No mod\n";
-    assert(false);
+// Compiles f to a module named after it. Functions that f calls as
+// dataflow stages are compiled first.
+CAC::Module* loadFunction(Context& c,
+                          Function* f,
+                          FunctionAnalyses& analyses,
+                          const LLVMLoadOptions& options) {
+  for (auto& instr : f->getEntryBlock()) {
+    if (isStageCall(&instr)) {
+      Function* callee = dyn_cast<CallInst>(&instr)->getCalledFunction();
+      if (!c.hasModule(string(callee->getName()))) {
+        loadFunction(c, callee, analyses, options);
+      }
+    }
   }
 
-  cout << "Loaded module" << endl;
-  Function* f = mod->getFunction(topFunction);
+  string topFunction = string(f->getName());
+  forwardSpilledArguments(f);
+  unrollLoops(f, analyses.fam, options);
 
   cout << "Converting function" << endl;
   cout << valueString(f);
 
   CAC::Module* m = c.addModule(topFunction);
-  addRAM32Primitive(c);
 
   // CAC::Module* mCall = c.addModule(topFunction + "_call");
 
@@ -270,6 +2328,9 @@ void loadLLVMFromFile(Context& c,
   m->addInPort(1, "start");
   m->addOutPort(1, "done");
 
+  // Start is a pulse when the module is a stage of another
+  m->setDefaultValue("start", 0);
+
   // Calling convention registers
   auto readyReg = m->freshReg(1, "ready");
   m->addSC(m->ipt("ready"), readyReg->pt("data"));
@@ -317,6 +2378,13 @@ void loadLLVMFromFile(Context& c,
 
   CodeGenState state;
   state.m = m;
+  state.unitLimits = options.unitLimits;
+  state.resourceLimits = options.resourceLimits;
+  state.chainDelay = options.chainDelay;
+  state.narrowWidths = options.narrowWidths;
+  if (options.narrowWidths) {
+    state.valueWidths = narrowedWidths(f, analyses.fam);
+  }
   
   for (Argument& arg : f->args()) {
     Type* tp = arg.getType();
@@ -329,9 +2397,31 @@ void loadLLVMFromFile(Context& c,
       string str = stp->getName();
       cout << "Name = " << str << endl;
 
-      assert(contains_key(str, builtinModDefs));
+      MemorySpec spec;
+      StreamSpec stream;
+      AxiSpec axi;
+      CAC::Module* def = nullptr;
+      if (parseAxiType(str, axi)) {
+        state.axiForArgs[&arg] = addAxiMaster(m, axi, string(arg.getName()));
+        continue;
+      } else if (parseStreamType(str, stream)) {
+        stream.isInput = !isWrittenStream(arg);
+        def = getStreamMod(c, stream);
+        state.streamsForArgs[&arg] = stream;
+      } else if (!parseMemoryType(str, spec)) {
+        cout << "Error: Argument type " << str << " is not a memory or stream" << endl;
+        assert(false);
+      } else if (contains_key(string(arg.getName()), options.partitions)) {
+        PartitionSpec part = map_find(string(arg.getName()), options.partitions);
+        checkPartition(spec, part);
+        def = getPartitionedMemoryMod(c, spec, part);
+        state.memoriesForArgs[&arg] = spec;
+        state.partitionsForArgs[&arg] = part;
+      } else {
+        def = getMemoryMod(c, spec);
+        state.memoriesForArgs[&arg] = spec;
+      }
 
-      CAC::Module* def = map_find(str, builtinModDefs);
       vector<Port> portsForArg;
       for (Port pt : def->getInterfacePorts()) {
         string ptName = string(arg.getName()) + "_" + pt.getName();
@@ -349,204 +2439,398 @@ void loadLLVMFromFile(Context& c,
     }
   }
 
+  int blockNum = 0;
   for (auto& bb : *f) {
     state.blockStarts[&bb] = m->addEmpty();
+    state.blockStarts[&bb]->profileLabel =
+      bb.hasName() ? bb.getName().str() : "bb" + to_string(blockNum);
+    blockNum++;
     for (auto& instrR : bb) {
       auto instr = &instrR;
-      if (AllocaInst::classof(instr)) {
+      StreamSpec stream;
+      if (AllocaInst::classof(instr) &&
+          StructType::classof(getPointedToType(instr->getType())) &&
+          dyn_cast<StructType>(getPointedToType(instr->getType()))->hasName() &&
+          parseStreamType(string(dyn_cast<StructType>(getPointedToType(instr->getType()))->getName()), stream)) {
+        auto fifo = m->freshInstanceSeq(getFifoMod(c, stream.width, options.fifoDepth), "stream");
+        state.fifosForAllocas[dyn_cast<AllocaInst>(instr)] = fifo;
+      } else if (AllocaInst::classof(instr)) {
         int width = getTypeBitWidth(getPointedToType(instr->getType()));
         auto chan = m->freshInstance(getRegMod(c, width), "alloca");
         state.registersForAllocas[dyn_cast<AllocaInst>(instr)] = chan;
+      } else if (isStageCall(instr)) {
+        // Stages must all have started before any of them is waited on
+        if (&bb != &(f->getEntryBlock()) || !instr->getType()->isVoidTy()) {
+          cout << "Error: Stage call " << valueString(instr) << " must return void and be in the entry block" << endl;
+          assert(false);
+        }
+
+        CallInst* call = dyn_cast<CallInst>(instr);
+        Function* callee = call->getCalledFunction();
+        auto stage = m->freshInstanceSeq(c.getModule(string(callee->getName())), string(callee->getName()));
+        state.stagesForCalls[instr] = stage;
+        state.stages.push_back(stage);
       } else if (LoadInst::classof(instr) ||
                  CallInst::classof(instr) ||
                  BinaryOperator::classof(instr) ||
                  CmpInst::classof(instr) ||
                  PHINode::classof(instr)) {
         if (!instr->getType()->isVoidTy()) {
-          int width = getTypeBitWidth(instr->getType());
+          int width = state.width(instr);
           auto chan = m->freshInstance(getChannelMod(c, width), "channel");
           state.channelsForValues[dyn_cast<Value>(instr)] = chan;
         }
+
+        if (PHINode::classof(instr)) {
+          int width = state.width(instr);
+          state.registersForPhis[dyn_cast<PHINode>(instr)] = m->freshReg(width, "phi");
+        }
       }
     }
   }
 
-  CC* entryInstr = nullptr;
-
+  int chainLimit = state.chainLimit(f);
   for (auto& bb : *f) {
-    vector<CC*> blkInstrs;
-
-    blkInstrs.push_back(state.blockStart(&bb));
-    for (auto& instrR : bb) {
-      Instruction* instr = &instrR;
-      if (AllocaInst::classof(instr)) {
-      } else if (BitCastInst::classof(instr)) {
-        cout << "Ignoring bitcast" << endl;
-      } else if (CallInst::classof(instr)) {
-        if (matchesCall("llvm.", instr)) {
-          cout << "Ignoring llvm builtin " << valueString(instr) << endl;
-        } else {
-          string funcName = calledFuncName(instr);          
-          cout << "Creating code for call to " << funcName << "..." << endl;
-
-          assert(contains_key(funcName, builtinModDefs));
-          
-          CAC::Module* inv = map_find(funcName, builtinModDefs);
-          assert(inv->isCallingConvention());
-
-          auto cc = m->addInvokeInstruction(inv);
+    vector<Instruction*> order = memoryAwareOrder(bb);
+    map<Instruction*, vector<Instruction*> > bursts = axiBursts(order);
+    vector<vector<Instruction*> > steps =
+      state.scheduleBlock(order, bursts, options.listSchedule || options.chainDelay != 0, chainLimit);
+    set<Instruction*> posted = postedWrites(steps);
+
+    CC* stepEnd = state.blockStart(&bb);
+    for (auto& step : steps) {
+      state.step++;
+
+      // The CCs of each instruction in the step, which run one per cycle
+      vector<vector<CC*> > stepInstrs;
+      vector<int> latencies;
+      for (Instruction* instr : step) {
+        vector<CC*> blkInstrs;
+        if (AllocaInst::classof(instr)) {
+        } else if (BitCastInst::classof(instr)) {
+          cout << "Ignoring bitcast" << endl;
+        } else if (isStreamAccess(instr) && state.streamArg(instr) != nullptr) {
+          Argument* streamArg = state.streamArg(instr);
+          StreamSpec spec = map_find(streamArg, state.streamsForArgs);
+          if (spec.isInput != isMemoryRead(instr)) {
+            cout << "Error: Access " << valueString(instr) << " is against the direction of its stream" << endl;
+            assert(false);
+          }
 
-          if (funcName == "read") {
-            // TODO: Generalize for arbitrary argument
-            cc->bind("ram32_128_raddr_0", m->ipt("ram_raddr_0"));
-            cc->bind("ram32_128_rdata_0", m->ipt("ram_rdata_0"));
+          CAC::Module* inv = c.getModule(streamActionName(spec));
+          CC* cc = m->addInvokeInstruction(inv);
 
-            Value* addr = instr->getOperand(1);
-            auto addrChannel = state.getChannel(addr);
-            auto targetChannel = state.getChannel(instr);
+          string streamName = streamModName(spec);
+          for (Port pt : inv->getInterfacePorts()) {
+            if (hasPrefix(pt.getName(), streamName + "_")) {
+              cc->bind(pt.getName(), state.argPort(streamArg, pt.getName().substr(streamName.size() + 1)));
+            }
+          }
 
-            cc->bind("raddr_0", addrChannel->pt("out"));
-            cc->bind("rdata_0", targetChannel->pt("in"));
+          if (spec.isInput) {
+            cc->bind("rdata_0", state.getChannel(instr)->pt("in"));
+          } else {
+            cc->bind("wdata_0", state.getChannel(instr->getOperand(1))->pt("out"));
+          }
 
-          } else if (funcName == "write") {
+          blkInstrs.push_back(cc);
+        } else if (isAxiAccess(instr) && state.axiArg(instr) != nullptr) {
+          // Accesses in a burst are issued by the burst's first read or last
+          // write
+          if (contains_key(instr, bursts)) {
+            vector<Instruction*> burst = map_find(instr, bursts);
+            AxiMaster master = map_find(state.axiArg(instr), state.axiForArgs);
+            bool isRead = isMemoryRead(instr);
+            int beats = burst.size();
+            if (beats > 1) {
+              cout << "Coalescing " << beats << " accesses into a burst at " << valueString(instr) << endl;
+            }
+
+            CAC::Module* inv = isRead ?
+              getAxiRead(c, master.spec, beats) : getAxiWrite(c, master.spec, beats);
+            CC* cc = m->addInvokeInstruction(inv);
+            bindToInstance(cc, isRead ? master.reader : master.writer);
+            bindToInstance(cc, master.stall);
+
+            auto addrChannel = state.getChannel(burst[0]->getOperand(1));
+            for (int i = 0; i < beats; i++) {
+              if (isRead) {
+                cc->bind("rdata_" + to_string(i), state.getChannel(burst[i])->pt("in"));
+              } else {
+                cc->bind("wdata_" + to_string(i), state.getChannel(burst[i]->getOperand(2))->pt("out"));
+              }
+            }
+            cc->bind(isRead ? "raddr_0" : "waddr_0", addrChannel->pt("out"));
+
+            blkInstrs.push_back(cc);
+          }
+        } else if (isStageCall(instr)) {
+          ModuleInstance* stage = map_find(instr, state.stagesForCalls);
+          CallInst* call = dyn_cast<CallInst>(instr);
+          for (int i = 0; i < (int) call->arg_size(); i++) {
+            state.connectStageArg(stage, call->getCalledFunction()->getArg(i), call->getArgOperand(i));
+          }
 
-            cout << "Creating code for write" << endl;
-            
-            // TODO: Generalize for arbitrary argument
-            cc->bind("ram32_128_waddr_0", m->ipt("ram_waddr_0"));
-            cc->bind("ram32_128_wdata_0", m->ipt("ram_wdata_0"));
-            cc->bind("ram32_128_wen_0", m->ipt("ram_wen_0"));
+          CC* cc = m->addInvokeInstruction(getStageStart(c, stage->source));
+          bindToInstance(cc, stage);
+          blkInstrs.push_back(cc);
+        } else if (CallInst::classof(instr)) {
+          if (matchesCall("llvm.", instr)) {
+            cout << "Ignoring llvm builtin " << valueString(instr) << endl;
+          } else {
+            string funcName = calledFuncName(instr);          
+            cout << "Creating code for call to " << funcName << "..." << endl;
+
+            if (!isMemoryAccess(instr)) {
+              cout << "Error: Unsupported call " << valueString(instr) << endl;
+              assert(false);
+            }
+
+            Argument* memArg = state.memoryArg(instr);
+            MemorySpec spec = map_find(memArg, state.memoriesForArgs);
+
+            bool isRead = isMemoryRead(instr);
+            int port = isRead ?
+              state.allocatePort(memArg, state.nextReadPort, spec.readPorts) :
+              state.allocatePort(memArg, state.nextWritePort, spec.writePorts);
+            bool isPosted = !isRead && elem(instr, posted);
+            if (isPosted) {
+              cout << "Posting write " << valueString(instr) << endl;
+            }
+
+            CAC::Module* inv = nullptr;
+            string memName = spec.name;
+            if (contains_key(memArg, state.partitionsForArgs)) {
+              PartitionSpec part = map_find(memArg, state.partitionsForArgs);
+              int bank = staticBank(spec, part, affineAddress(instr->getOperand(1)));
+              inv = isRead ?
+                getPartitionedRead(c, spec, part, port, bank) :
+                getPartitionedWrite(c, spec, part, port, bank, isPosted);
+              memName = partitionedMemoryName(spec, part);
+            } else if (isRead) {
+              inv = c.getModule(readActionName(spec, port));
+            } else {
+              inv = c.getModule(isPosted ? postedWriteActionName(spec, port) : writeActionName(spec, port));
+            }
+            assert(inv->isCallingConvention());
+
+            CC* cc = m->addInvokeInstruction(inv);
+
+            // Action ports named after the memory connect to the ports of
+            // the argument
+            for (Port pt : inv->getInterfacePorts()) {
+              if (hasPrefix(pt.getName(), memName + "_")) {
+                cc->bind(pt.getName(), state.argPort(memArg, pt.getName().substr(memName.size() + 1)));
+              }
+            }
 
             Value* addr = instr->getOperand(1);
             auto addrChannel = state.getChannel(addr);
+            if (isRead) {
+              auto targetChannel = state.getChannel(instr);
+
+              cc->bind("raddr_0", addrChannel->pt("out"));
+              cc->bind("rdata_0", targetChannel->pt("in"));
+            } else {
+              Value* targetVal = instr->getOperand(2);
+              auto dataChannel = state.getChannel(targetVal);
 
-            Value* targetVal = instr->getOperand(2);
-            auto dataChannel = state.getChannel(targetVal);
+              cc->bind("waddr_0", addrChannel->pt("out"));
+              cc->bind("wdata_0", dataChannel->pt("out"));
+              cc->bind("wen_0", m->c(1, 1));
+            }
 
-            cc->bind("waddr_0", addrChannel->pt("out"));
-            cc->bind("wdata_0", dataChannel->pt("out"));
-            cc->bind("wen_0", m->c(1, 1));
+            blkInstrs.push_back(cc);
+          }
+        } else if (ReturnInst::classof(instr)) {
+          // Writes to AXI arguments must land before the kernel is done
+          for (auto arg : state.axiForArgs) {
+            CC* fence = m->addInvokeInstruction(c.getModule("axi_stall_manager_fence"));
+            bindToInstance(fence, arg.second.stall);
+            blkInstrs.push_back(fence);
+          }
 
-            cout << "Done code for write" << endl;
+          for (auto stage : state.stages) {
+            CC* join = m->addInvokeInstruction(getStageJoin(c, stage->source));
+            bindToInstance(join, stage);
+            blkInstrs.push_back(join);
           }
 
+          auto cc = m->addEmptyInstruction();
+          cc->then(m->c(1, 1), progEnd, 0);
           blkInstrs.push_back(cc);
-        }
-      } else if (ReturnInst::classof(instr)) {
-        auto cc = m->addEmptyInstruction();
-        cc->then(m->c(1, 1), progEnd, 0);
-        blkInstrs.push_back(cc);
-      } else if (LoadInst::classof(instr)) {
-        cout << "Need to get module for load" << endl;
-        auto arg = instr->getOperand(0);
-        assert(AllocaInst::classof(arg));
-        ModuleInstance* reg = map_find(dyn_cast<AllocaInst>(arg), state.registersForAllocas);
-        ModuleInstance* chan = map_find(dyn_cast<Value>(instr),
-                                        state.channelsForValues);
-        CC* readReg = m->addCC(chan->pt("in"), reg->pt("data"));
+        } else if (LoadInst::classof(instr)) {
+          cout << "Need to get module for load" << endl;
+          auto arg = instr->getOperand(0);
+          assert(AllocaInst::classof(arg));
+          ModuleInstance* reg = map_find(dyn_cast<AllocaInst>(arg), state.registersForAllocas);
+          ModuleInstance* chan = map_find(dyn_cast<Value>(instr),
+                                          state.channelsForValues);
+          CC* readReg = m->addCC(chan->pt("in"), reg->pt("data"));
         
-        blkInstrs.push_back(readReg);
+          blkInstrs.push_back(readReg);
 
-      } else if (BinaryOperator::classof(instr)) {
-        auto v0 = instr->getOperand(0);
-        auto c0 = state.getChannel(v0);
-        
-        auto v1 = instr->getOperand(1);
-        auto c1 = state.getChannel(v1);
+        } else if (StoreInst::classof(instr)) {
+          StoreInst* store = dyn_cast<StoreInst>(instr);
+          if (!AllocaInst::classof(store->getPointerOperand())) {
+            cout << "Error: Unsupported store " << valueString(instr) << endl;
+            assert(false);
+          }
+
+          ModuleInstance* reg = state.getReg(store->getPointerOperand());
+          CC* writeReg = m->addInvokeInstruction(reg->action("st"));
+          bindByType(writeReg, reg);
+          writeReg->bind("in", state.getChannel(store->getValueOperand())->pt("out"));
+          writeReg->bind("en", m->c(1, 1));
 
-        auto out = instr;
-        auto outC = state.getChannel(out);
+          blkInstrs.push_back(writeReg);
 
-        int width = getTypeBitWidth(out->getType());
+        } else if (BinaryOperator::classof(instr)) {
+          auto v0 = instr->getOperand(0);
+          auto c0 = state.getChannel(v0);
         
-        // TODO: Generalize adder
-        string name = "add_" + to_string(width);
-        addBinop(c, name, 0);
-
-        CAC::Module* opMod = c.getModule(name);
-        auto op = m->freshInstance(opMod, "add");
-        auto opApply = op->action("apply");
-        auto opApplyInv = m->addInvokeInstruction(opApply);
-        bindByType(opApplyInv, op);
-        opApplyInv->bind("in0", c0->pt("out"));
-        opApplyInv->bind("in1", c1->pt("out"));
-        opApplyInv->bind("out", outC->pt("in"));        
-        blkInstrs.push_back(opApplyInv);
-      } else if (BranchInst::classof(instr)) {
-        BranchInst* br = dyn_cast<BranchInst>(instr);
-        if (br->isConditional()) {
-          assert(br->getNumSuccessors());
+          auto v1 = instr->getOperand(1);
+          auto c1 = state.getChannel(v1);
+
+          auto out = instr;
+          auto outC = state.getChannel(out);
+
+          string opName = state.operatorName(instr);
+          CAC::Module* opMod = state.operatorMod(instr);
+          auto op = state.bindUnit(opMod, opName);
+          auto opApply = op->action("apply");
+          auto opApplyInv = m->addInvokeInstruction(opApply);
+          bindByType(opApplyInv, op);
+          opApplyInv->bind("in0", c0->pt("out"));
+          opApplyInv->bind("in1", c1->pt("out"));
+          opApplyInv->bind("out", outC->pt("in"));        
+          blkInstrs.push_back(opApplyInv);
+        } else if (BranchInst::classof(instr)) {
+          BranchInst* br = dyn_cast<BranchInst>(instr);
+          if (br->isConditional()) {
+            assert(br->getNumSuccessors());
           
-          BasicBlock* s0 = br->getSuccessor(0);
-          BasicBlock* s1 = br->getSuccessor(1);
+            BasicBlock* s0 = br->getSuccessor(0);
+            BasicBlock* s1 = br->getSuccessor(1);
 
-          auto brCond = state.getChannel(br->getOperand(0));
+            auto brCond = state.getChannel(br->getOperand(0));
 
-          cout << "Got channel for " << valueString(br->getOperand(0)) << endl;
-          auto brI = m->addEmpty();
-          brI->continueTo(brCond->pt("out"), state.blockStart(s0), 1);
-          brI->continueTo(notVal(brCond->pt("out"), m), state.blockStart(s1), 1);
+            cout << "Got channel for " << valueString(br->getOperand(0)) << endl;
+            auto brI = m->addEmpty();
+            state.branchTo(brI, brCond->pt("out"), &bb, s0);
+            state.branchTo(brI, notVal(brCond->pt("out"), m), &bb, s1);
 
-          blkInstrs.push_back(brI);
-        } else {
-          BasicBlock* s = br->getSuccessor(0);
+            blkInstrs.push_back(brI);
+          } else {
+            BasicBlock* s = br->getSuccessor(0);
 
-          auto brI = m->addEmpty();
-          brI->continueTo(m->c(1, 1), state.blockStart(s), 1); //map_find(s, state.blockStarts), 1);
-          blkInstrs.push_back(brI);
-        }
-      } else if (PHINode::classof(instr)) {
-        // TODO: Fill in PHI node
+            auto brI = m->addEmpty();
+            state.branchTo(brI, m->c(1, 1), &bb, s);
+            blkInstrs.push_back(brI);
+          }
+        } else if (PHINode::classof(instr)) {
+          // The incoming edge already stored the value in the PHI register
+          ModuleInstance* reg = state.getPhiReg(dyn_cast<PHINode>(instr));
+          ModuleInstance* chan = state.getChannel(instr);
+          CC* readPhi = m->addCC(chan->pt("in"), reg->pt("data"));
+
+          blkInstrs.push_back(readPhi);
+        } else if (CmpInst::classof(instr)) {
+          auto in0 = state.getChannel(instr->getOperand(0));
+          auto in1 = state.getChannel(instr->getOperand(1));
+          auto out = state.getChannel(instr);
+
+          string name = state.operatorName(instr);
+          CAC::Module* opMod = state.operatorMod(instr);
+
+          auto op = state.bindUnit(opMod, name);
+          auto opApply = op->action("apply");
+          auto opApplyInv = m->addInvokeInstruction(opApply);
+          bindByType(opApplyInv, op);
+          opApplyInv->bind("in0", in0->pt("out"));
+          opApplyInv->bind("in1", in1->pt("out"));
+          opApplyInv->bind("out", out->pt("in"));
+          blkInstrs.push_back(opApplyInv);
         
-      } else if (CmpInst::classof(instr)) {
-        auto in0 = state.getChannel(instr->getOperand(0));
-        auto in1 = state.getChannel(instr->getOperand(1));
-        auto out = state.getChannel(instr);
-
-        auto cmpI = dyn_cast<CmpInst>(instr);
-        llvm::CmpInst::Predicate p = cmpI->getPredicate();
-        string name = "";
-        if (p == llvm::CmpInst::ICMP_SGT) {
-          name = "sgt";
+        } else {
+          cout << "Error: Unsupported instruction " << valueString(instr) << endl;
+          assert(false);
         }
 
-        assert(name != "");
+        if (!blkInstrs.empty()) {
+          stepInstrs.push_back(blkInstrs);
+          latencies.push_back(blkInstrs.size() == 1 ? state.latency(instr, posted) : -1);
+        }
+      }
 
-        int width = getTypeBitWidth(instr->getOperand(0)->getType());        
-        CAC::Module* opMod = addComparator(c, name, width);
+      if (stepInstrs.empty()) {
+        continue;
+      }
 
-        auto op = m->freshInstance(opMod, "cmp");
-        auto opApply = op->action("apply");
-        auto opApplyInv = m->addInvokeInstruction(opApply);
-        bindByType(opApplyInv, op);
-        opApplyInv->bind("in0", in0->pt("out"));
-        opApplyInv->bind("in1", in1->pt("out"));
-        opApplyInv->bind("out", out->pt("in"));
-        blkInstrs.push_back(opApplyInv);
-        
-      } else {
-        cout << "Error: Unsupported instruction " << valueString(instr) << endl;
-        assert(false);
+      // Instructions that take no cycles run one after another in the
+      // first cycle of the step, so chained operators see the values
+      // computed before them
+      vector<CC*> sameCycle;
+      for (int i = 0; i < (int) stepInstrs.size(); i++) {
+        if (latencies[i] == 0) {
+          sameCycle.push_back(stepInstrs[i][0]);
+        }
+      }
+      for (int i = (int) latencies.size() - 1; i >= 0; i--) {
+        if (latencies[i] == 0) {
+          stepInstrs.erase(stepInstrs.begin() + i);
+          latencies.erase(latencies.begin() + i);
+        }
+      }
+      if (!sameCycle.empty()) {
+        stepInstrs.push_back(sameCycle);
+        latencies.push_back(0);
       }
 
-    }
+      // The next step starts the cycle after the longest instruction in
+      // this one ends
+      int longest = 0;
+      for (int i = 0; i < (int) stepInstrs.size(); i++) {
+        vector<CC*>& ccs = stepInstrs[i];
+        int delay = latencies[i] == 0 ? 0 : 1;
+        stepEnd->continueTo(m->constOut(1, 1), ccs[0], 1);
+        for (int j = 0; j < (int) ccs.size() - 1; j++) {
+          ccs[j]->continueTo(m->constOut(1, 1), ccs[j + 1], delay);
+        }
 
-    for (int i = 0; i < (int) blkInstrs.size() - 1; i++) {
-      auto instr = blkInstrs[i];
-      auto nextInstr = blkInstrs[i + 1];
-      instr->continueTo(m->constOut(1, 1), nextInstr, 1);
+        if (latencies[i] > latencies[longest]) {
+          longest = i;
+        }
+      }
+      stepEnd = stepInstrs[longest].back();
     }
 
     if (&(f->getEntryBlock()) == &bb) {
       cout << "Setting entry instruction" << endl;
-      
-      assert(blkInstrs.size() > 0);
-      
-      entryInstr = blkInstrs[0];
-      progStart->then(m->c(1, 1), entryInstr, 0);
-
-      cout << "Done setting instruction" << endl;
+      progStart->then(m->c(1, 1), state.blockStart(&bb), 0);
     }
   }
 
+  return m;
+}
+
+void loadLLVMFromFile(Context& c,
+                      const std::string& topFunction,
+                      const std::string& filePath,
+                      const LLVMLoadOptions& options) {
+
+  SMDiagnostic err;
+  LLVMContext context;
+
+  std::unique_ptr<llvm::Module> mod(parseIRFile(filePath, err, context));
+  if (!mod) {
+    outs() << "Error: No mod\n";
+    assert(false);
+  }
+
+  cout << "Loaded module" << endl;
+  Function* f = mod->getFunction(topFunction);
+
+  FunctionAnalyses analyses;
+  loadFunction(c, f, analyses, options);
 }
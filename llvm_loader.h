@@ -2,6 +2,67 @@
 
 #include "ir.h"
 
+// How to split a memory argument into banks. cyclic places word i in
+// bank i % factor, block places consecutive runs of depth / factor words
+// in each bank, and complete gives every word its own bank. Factors must
+// be powers of two so that decoding is a mask and a shift.
+class PartitionSpec {
+public:
+  std::string kind;
+  int factor;
+
+  PartitionSpec() : kind("none"), factor(1) {}
+  PartitionSpec(const std::string& kind_, const int factor_) :
+    kind(kind_), factor(factor_) {}
+};
+
+class LLVMLoadOptions {
+public:
+  // Keyed by the name of the memory argument
+  std::map<std::string, PartitionSpec> partitions;
+
+  // Unroll factor for every loop in the named function, 0 for full
+  // unrolling. Loops can also be annotated in the source with
+  // #pragma unroll, which is honored whether or not a factor is given here.
+  std::map<std::string, int> unrollFactors;
+
+  // Shrink values to the bits their proven range needs
+  bool narrowWidths;
+
+  // Depth of the fifos that carry local streams between dataflow stages
+  int fifoDepth;
+
+  // Most instances of each width of the named operators, such as mul or
+  // sgt. Operators not named here get an instance per operation.
+  std::map<std::string, int> unitLimits;
+
+  // Start independent instructions of a block in the same cycle instead of
+  // one per cycle
+  bool listSchedule;
+
+  // Most instructions using each resource that list scheduling starts in
+  // one cycle. Resources are named after the primitives in the Context,
+  // such as mul_32 or sgt_16, and accesses to a memory like ram_32_128 use
+  // ram_32_128_read or ram_32_128_write. A name ending in * matches every
+  // resource it is a prefix of.
+  std::map<std::string, int> resourceLimits;
+
+  // Longest combinational delay, as estimated by operatorDelay, that list
+  // scheduling may build by chaining dependent operators into one cycle.
+  // 0 puts a register after every operator. -1 uses the delay of the
+  // slowest operator in the function, which merges short operators
+  // without lengthening the critical path.
+  int chainDelay;
+
+  LLVMLoadOptions() :
+    narrowWidths(true), fifoDepth(16), listSchedule(false), chainDelay(0) {}
+};
+
 void loadLLVMFromFile(CAC::Context& c,
                       const std::string& topFunction,
                       const std::string& filePath);
+
+void loadLLVMFromFile(CAC::Context& c,
+                      const std::string& topFunction,
+                      const std::string& filePath,
+                      const LLVMLoadOptions& options);
@@ -1,6 +1,18 @@
 #include "llvm_loader.h"
 
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <mutex>
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "parser.h"
 
@@ -19,7 +31,9 @@ void runCmd(const std::string& cmd) {
   assert(res == 0);
 }
 
-bool runIVerilogTB(const std::string& moduleName) {
+// Compiles tb_<moduleName>.v against <moduleName>.v and returns what the
+// simulation prints
+std::string simulationOutput(const std::string& moduleName) {
   string mainName = "tb_" + moduleName + ".v";
   string modFile = moduleName + ".v";
 
@@ -27,18 +41,23 @@ bool runIVerilogTB(const std::string& moduleName) {
 
   runCmd(genCmd);
 
-  string resFile = moduleName + "_tb_result.txt";
-  string exeCmd = "./" + moduleName + " > " + resFile;
-  runCmd(exeCmd);
+  FILE* sim = popen(("./" + moduleName).c_str(), "r");
+  assert(sim != nullptr);
 
-  ifstream res(resFile);
-  std::string str((std::istreambuf_iterator<char>(res)),
-                  std::istreambuf_iterator<char>());
+  string str;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), sim)) > 0) {
+    str.append(buf, n);
+  }
+  int res = pclose(sim);
+  assert(res == 0);
 
   cout << "str = " << str << endl;
-    
-  //runCmd("rm -f " + resFile);
+  return str;
+}
 
+std::string lastLine(std::string str) {
   reverse(begin(str), end(str));
   string lastLine;
 
@@ -53,12 +72,567 @@ bool runIVerilogTB(const std::string& moduleName) {
   reverse(begin(lastLine), end(lastLine));
 
   cout << "Lastline = " << lastLine << endl;
-  return lastLine == "Passed";
+  return lastLine;
+}
+
+bool runIVerilogTB(const std::string& moduleName) {
+  return lastLine(simulationOutput(moduleName)) == "Passed";
+}
+
+// Generated modules for measuring how the passes scale. Each kind
+// stresses one dimension of the IR and has roughly size CCs:
+//   sequence - a chain of CCs one cycle apart, each setting one of 8 outputs
+//   branches - one CC that branches to size CCs on comparisons of an input
+//   channels - a chain of channels, each read one cycle after it is written
+//   delays   - a chain of CCs 16 cycles apart, for synthesizeDelays to expand
+//   fanin    - a chain of CCs that all set the same output
+Module* syntheticModule(Context& c, const std::string& kind, const int size) {
+  Module* m = c.addModule(kind + "_" + to_string(size));
+  m->addInPort(16, "in");
+  m->addOutPort(16, "out");
+
+  vector<Port> consts;
+  for (int i = 0; i < 64; i++) {
+    consts.push_back(m->c(16, i));
+  }
+  Port one = m->c(1, 1);
+
+  CC* start = m->addEmpty();
+  start->setIsStartAction(true);
+
+  if (kind == "sequence") {
+    for (int i = 0; i < 8; i++) {
+      m->addOutPort(16, "out_" + to_string(i));
+    }
+
+    CC* last = start;
+    for (int i = 0; i < size; i++) {
+      CC* next = m->addCC(m->ipt("out_" + to_string(i % 8)), m->ipt("in"));
+      last->continueTo(one, next, 1);
+      last = next;
+    }
+    last->continueTo(one, start, 1);
+  } else if (kind == "branches") {
+    Module* eq = getComparatorMod(c, "eq", 16);
+    for (int i = 0; i < size; i++) {
+      ModuleInstance* cmp = m->freshInstance(eq, "is_case");
+      m->addSC(cmp->pt("in0"), m->ipt("in"));
+      m->addSC(cmp->pt("in1"), m->c(16, i));
+
+      CC* caseBody = m->addCC(m->ipt("out"), consts[i % consts.size()]);
+      start->continueTo(cmp->pt("out"), caseBody, 0);
+      caseBody->continueTo(one, start, 1);
+    }
+  } else if (kind == "channels") {
+    Module* chanMod = getChannelMod(c, 16);
+    Port value = m->ipt("in");
+    CC* last = start;
+    for (int i = 0; i < size; i++) {
+      ModuleInstance* chan = m->freshInstance(chanMod, "chan");
+      CC* next = m->addCC(chan->pt("in"), value);
+      last->continueTo(one, next, 1);
+      last = next;
+      value = chan->pt("out");
+    }
+
+    CC* result = m->addCC(m->ipt("out"), value);
+    last->continueTo(one, result, 1);
+    result->continueTo(one, start, 1);
+  } else if (kind == "delays") {
+    CC* last = start;
+    for (int i = 0; i < size / 16; i++) {
+      CC* next = m->addCC(m->ipt("out"), consts[i % consts.size()]);
+      last->continueTo(one, next, 16);
+      last = next;
+    }
+    last->continueTo(one, start, 16);
+  } else if (kind == "fanin") {
+    CC* last = start;
+    for (int i = 0; i < size; i++) {
+      CC* next = m->addCC(m->ipt("out"), consts[i % consts.size()]);
+      last->continueTo(one, next, 1);
+      last = next;
+    }
+    last->continueTo(one, start, 1);
+  } else {
+    cout << "Error: Unsupported synthetic module kind " << kind << endl;
+    assert(false);
+  }
+
+  return m;
+}
+
+// Seconds each pass took on one synthetic module, and the peak resident
+// set of the process that ran them. Cases that did not finish within the
+// time limit have timedOut set.
+class BenchmarkResult {
+public:
+  std::string kind;
+  int size;
+  vector<pair<string, double> > passTimes;
+  long peakRSSKB;
+  bool timedOut;
+};
+
+// Runs in a child process so that the peak RSS belongs to one case and a
+// case that runs too long can be killed. Results come back as lines on fd.
+void runBenchmarkCase(const std::string& kind, const int size, const int fd) {
+  // The passes log heavily, which is part of what they cost
+  int devNull = open("/dev/null", O_WRONLY);
+  dup2(devNull, 1);
+
+  Context c;
+  Module* m = syntheticModule(c, kind, size);
+
+  vector<pair<string, function<void()> > > passes{
+    {"inlineInvokes", [m]() { inlineInvokes(m); }},
+    {"synthesizeDelays", [m]() { synthesizeDelays(m); }},
+    {"deleteNoEffectInstructions", [m]() { deleteNoEffectInstructions(m); }},
+    {"synthesizeChannels", [m]() { synthesizeChannels(m); }},
+    {"reduceStructures", [m]() { reduceStructures(m); }},
+    {"foldConstants", [m]() { foldConstants(m); }},
+    {"deleteUnreachableInstructions", [m]() { deleteUnreachableInstructions(m); }},
+    {"emitVerilog", [&c, m]() { emitVerilogString(c, m, VerilogEmitOptions()); }}};
+
+  for (auto pass : passes) {
+    auto before = chrono::steady_clock::now();
+    pass.second();
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - before;
+
+    string line = pass.first + " " + to_string(elapsed.count()) + "\n";
+    ssize_t written = write(fd, line.c_str(), line.size());
+    assert(written == (ssize_t) line.size());
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  string line = "peak_rss_kb " + to_string(usage.ru_maxrss) + "\n";
+  ssize_t written = write(fd, line.c_str(), line.size());
+  assert(written == (ssize_t) line.size());
+}
+
+BenchmarkResult benchmarkCase(const std::string& kind,
+                              const int size,
+                              const int timeLimitSeconds) {
+  int fds[2];
+  int piped = pipe(fds);
+  assert(piped == 0);
+
+  pid_t child = fork();
+  assert(child >= 0);
+  if (child == 0) {
+    close(fds[0]);
+    alarm(timeLimitSeconds);
+    runBenchmarkCase(kind, size, fds[1]);
+    _exit(0);
+  }
+
+  close(fds[1]);
+  string out;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fds[0], buf, sizeof(buf))) > 0) {
+    out.append(buf, n);
+  }
+  close(fds[0]);
+
+  int status;
+  waitpid(child, &status, 0);
+
+  BenchmarkResult res{kind, size, {}, 0, !WIFEXITED(status) || WEXITSTATUS(status) != 0};
+  istringstream lines(out);
+  string name;
+  double value;
+  while (lines >> name >> value) {
+    if (name == "peak_rss_kb") {
+      res.peakRSSKB = (long) value;
+    } else {
+      res.passTimes.push_back({name, value});
+    }
+  }
+  return res;
+}
+
+// Baseline lines are <kind> <size> <pass> <seconds>, with peak_rss_kb and
+// timeout as pass names for the other measurements
+map<string, double> benchmarkTable(const vector<BenchmarkResult>& results) {
+  map<string, double> table;
+  for (auto& res : results) {
+    string key = res.kind + " " + to_string(res.size) + " ";
+    for (auto pt : res.passTimes) {
+      table[key + pt.first] = pt.second;
+    }
+    table[key + "peak_rss_kb"] = res.peakRSSKB;
+    table[key + "timeout"] = res.timedOut ? 1 : 0;
+  }
+  return table;
+}
+
+// Usage: bench [--update-baseline] [sizes...]. Runs every kind at each size
+// (1k to 1M CCs by default) and compares against bench_baseline.txt. A
+// measurement regresses when it is over twice its baseline and, for times,
+// at least 0.1 seconds slower. Timings depend on the machine, so the
+// baseline is not committed; record one with --update-baseline first.
+int runCompileBenchmarks(const vector<string>& args) {
+  bool update = false;
+  vector<int> sizes;
+  for (auto arg : args) {
+    if (arg == "--update-baseline") {
+      update = true;
+    } else {
+      sizes.push_back(stoi(arg));
+    }
+  }
+  if (sizes.empty()) {
+    sizes = {1000, 10000, 100000, 1000000};
+  }
+
+  string baselineFile = "./bench_baseline.txt";
+  ifstream baselineIn(baselineFile);
+  if (!update && !baselineIn) {
+    cout << "Error: No " << baselineFile << ", run bench --update-baseline to record one on this machine" << endl;
+    return 1;
+  }
+
+  vector<BenchmarkResult> results;
+  for (auto kind : {"sequence", "branches", "channels", "delays", "fanin"}) {
+    // Larger sizes of a kind that timed out would only time out again
+    for (auto size : sizes) {
+      BenchmarkResult res = benchmarkCase(kind, size, 600);
+      results.push_back(res);
+
+      double total = 0;
+      for (auto pt : res.passTimes) {
+        total += pt.second;
+      }
+      cout << kind << " " << size << ": " << total << " s, " <<
+        res.peakRSSKB << " KB peak RSS" << (res.timedOut ? ", timed out" : "") << endl;
+      if (res.timedOut) {
+        break;
+      }
+    }
+  }
+
+  map<string, double> table = benchmarkTable(results);
+
+  if (update) {
+    ofstream baselineOut(baselineFile);
+    for (auto entry : table) {
+      baselineOut << entry.first << " " << entry.second << endl;
+    }
+    cout << "Wrote " << baselineFile << endl;
+    return 0;
+  }
+
+  map<string, double> baseline;
+  string kind, pass;
+  int size;
+  double value;
+  while (baselineIn >> kind >> size >> pass >> value) {
+    baseline[kind + " " + to_string(size) + " " + pass] = value;
+  }
+
+  int regressions = 0;
+  for (auto entry : table) {
+    if (!contains_key(entry.first, baseline)) {
+      cout << "No baseline for " << entry.first << endl;
+      continue;
+    }
+
+    double old = map_find(entry.first, baseline);
+    bool isTime = entry.first.find("peak_rss_kb") == string::npos &&
+      entry.first.find("timeout") == string::npos;
+    bool worse = entry.second > 2*old &&
+      (!isTime || entry.second - old >= 0.1);
+    if (worse) {
+      cout << "Regression: " << entry.first << " " << old << " -> " << entry.second << endl;
+      regressions++;
+    }
+  }
+
+  cout << regressions << " regressions against " << baselineFile << endl;
+  return regressions == 0 ? 0 : 1;
+}
+
+// One row of the quality of results table
+class QoRResult {
+public:
+  std::string kernel;
+  int cycles;
+  int registers;
+  int resources;
+  int verilogLines;
+};
+
+// The testbench prints the cycles from start to done as "cycles = N"
+int testbenchCycles(const std::string& simOutput) {
+  istringstream res(simOutput);
+  string line;
+  while (getline(res, line)) {
+    if (line.find("cycles = ") == 0) {
+      return stoi(line.substr(string("cycles = ").size()));
+    }
+  }
+  cout << "Error: No cycle count in simulation output" << endl;
+  assert(false);
+  return -1;
+}
+
+QoRResult measureQoR(Module* m, const std::string& simOutput) {
+  QoRResult res{m->getName(), testbenchCycles(simOutput), 0, 0, 0};
+  for (auto r : m->getResources()) {
+    if (isConstant(r)) {
+      continue;
+    }
+
+    res.resources++;
+    if (r->source->getVerilogDeclString().find("mod_register") == 0) {
+      res.registers++;
+    }
+  }
+
+  ifstream verilog(m->getName() + ".v");
+  string line;
+  while (getline(verilog, line)) {
+    res.verilogLines++;
+  }
+  return res;
+}
+
+// Rows of a results table, keyed by kernel, as cycles, registers,
+// resources and verilog_lines
+map<string, vector<int> > readQoRTable(const std::string& file) {
+  map<string, vector<int> > rows;
+  ifstream in(file);
+  string header;
+  getline(in, header);
+
+  string kernel;
+  int cycles, registers, resources, verilogLines;
+  while (in >> kernel >> cycles >> registers >> resources >> verilogLines) {
+    rows[kernel] = {cycles, registers, resources, verilogLines};
+  }
+  return rows;
+}
+
+void writeQoRTable(const std::string& file, const map<string, vector<int> >& rows) {
+  ofstream table(file);
+  table << "kernel cycles registers resources verilog_lines" << endl;
+  for (auto& row : rows) {
+    table << row.first;
+    for (auto v : row.second) {
+      table << " " << v;
+    }
+    table << endl;
+  }
+}
+
+// Compiles each kernel in c_files/qor_*.c, checks it against its
+// testbench, writes a table of results to resultsFile and compares it with
+// baselineFile. A kernel without a baseline row or with any difference
+// fails the suite. The two tables have the same format, so new results are
+// accepted by copying rows from resultsFile into baselineFile.
+void runQoRSuite(const std::string& resultsFile, const std::string& baselineFile) {
+  vector<string> kernels{"qor_vector_add",
+                         "qor_dot_product",
+                         "qor_fir",
+                         "qor_matmul",
+                         "qor_histogram",
+                         "qor_prefix_sum",
+                         "qor_memcpy"};
+
+  vector<QoRResult> results;
+  for (auto kernel : kernels) {
+    // The loader has no vector types, and these loops unroll into code
+    // that would otherwise be vectorized
+    runCmd("clang -S -emit-llvm ./c_files/" + kernel + ".c -c -O3 -fno-vectorize -fno-slp-vectorize");
+
+    Context c;
+    loadLLVMFromFile(c, kernel, "./" + kernel + ".ll");
+
+    Module* m = c.getModule(kernel);
+    assert(m != nullptr);
+
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);
+    synthesizeChannels(m);
+    reduceStructures(m);
+    foldConstants(m);
+    deleteNoEffectInstructions(m);
+    deleteUnreachableInstructions(m);
+
+    emitVerilog(c, m);
+    string simOutput = simulationOutput(m->getName());
+    assert(lastLine(simOutput) == "Passed");
+
+    results.push_back(measureQoR(m, simOutput));
+  }
+
+  map<string, vector<int> > table;
+  for (auto& res : results) {
+    table[res.kernel] = {res.cycles, res.registers, res.resources, res.verilogLines};
+  }
+  writeQoRTable(resultsFile, table);
+  runCmd("cat " + resultsFile);
+
+  vector<string> columns{"cycles", "registers", "resources", "verilog_lines"};
+  map<string, vector<int> > baseline = readQoRTable(baselineFile);
+  int differences = 0;
+  for (auto& row : table) {
+    if (!contains_key(row.first, baseline)) {
+      cout << "QoR change: " << row.first << " has no row in " << baselineFile << endl;
+      differences++;
+      continue;
+    }
+
+    vector<int> old = map_find(row.first, baseline);
+    for (int i = 0; i < (int) columns.size(); i++) {
+      if (old[i] != row.second[i]) {
+        cout << "QoR change: " << row.first << " " << columns[i] << " " <<
+          old[i] << " -> " << row.second[i] << endl;
+        differences++;
+      }
+    }
+  }
+
+  cout << differences << " differences against " << baselineFile << endl;
+  assert(differences == 0);
+}
+
+class TestCase {
+public:
+  std::string name;
+  function<void()> run;
+};
+
+class TestResult {
+public:
+  bool passed;
+  std::string output;
+};
+
+// Tests read their inputs and write their outputs by relative path, so
+// each one runs in test_scratch/<name> with links to the inputs
+void setUpScratchDir(const std::string& root, const std::string& dir) {
+  runCmd("rm -rf " + dir + " && mkdir -p " + dir);
+
+  DIR* rootDir = opendir(root.c_str());
+  assert(rootDir != nullptr);
+  struct dirent* entry;
+  while ((entry = readdir(rootDir)) != nullptr) {
+    string name = entry->d_name;
+    bool isInput = name.find("tb_") == 0 ||
+      (name.size() > 3 && name.substr(name.size() - 3) == ".iv") ||
+      name == "builtins.v" || name == "RAM.v" || name == "delay.v" ||
+      name == "c_files";
+    if (isInput) {
+      int res = symlink((root + "/" + name).c_str(), (dir + "/" + name).c_str());
+      assert(res == 0);
+    }
+  }
+  closedir(rootDir);
+}
+
+// Runs test in the scratch directory under the current one. This is what
+// the child processes of runTestCase exec.
+void runTestInScratchDir(const TestCase& test) {
+  char cwd[4096];
+  char* res = getcwd(cwd, sizeof(cwd));
+  assert(res != nullptr);
+  string root = cwd;
+
+  string dir = root + "/test_scratch/" + test.name;
+  setUpScratchDir(root, dir);
+  int moved = chdir(dir.c_str());
+  assert(moved == 0);
+
+  test.run();
 }
 
-int main() {
+// Pipes are created and forked from under this lock with close-on-exec
+// set, so no child inherits the pipe of a test running next to it
+mutex forkLock;
 
+// Runs test in a child process, which keeps its working directory and a
+// failed assert to itself, and collects everything it prints. The child
+// only execs self with --run-test, since the parent has other threads.
+TestResult runTestCase(const TestCase& test, const std::string& self) {
+  int fds[2];
+  pid_t child;
   {
+    lock_guard<mutex> lock(forkLock);
+    int res = pipe(fds);
+    assert(res == 0);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    child = fork();
+    assert(child >= 0);
+    if (child == 0) {
+      dup2(fds[1], 1);
+      dup2(fds[1], 2);
+      execlp(self.c_str(), self.c_str(), "--run-test", test.name.c_str(), (char*) nullptr);
+      _exit(127);
+    }
+  }
+
+  close(fds[1]);
+  string out;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fds[0], buf, sizeof(buf))) > 0) {
+    out.append(buf, n);
+  }
+  close(fds[0]);
+
+  int status;
+  waitpid(child, &status, 0);
+  return {WIFEXITED(status) && WEXITSTATUS(status) == 0, out};
+}
+
+// Runs tests on jobs threads and prints the output of the ones that fail.
+// self is the path this program was run as.
+bool runTests(const vector<TestCase>& tests, const int jobs, const std::string& self) {
+  vector<TestResult> results(tests.size());
+  atomic<int> next(0);
+  int finished = 0;
+  mutex printLock;
+
+  vector<thread> workers;
+  for (int w = 0; w < jobs; w++) {
+    workers.emplace_back([&]() {
+        for (int i = next++; i < (int) tests.size(); i = next++) {
+          results[i] = runTestCase(tests[i], self);
+
+          lock_guard<mutex> lock(printLock);
+          finished++;
+          cout << "[" << finished << "/" << tests.size() << "] " << tests[i].name <<
+            (results[i].passed ? " passed" : " FAILED") << endl;
+        }
+      });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+
+  int failures = 0;
+  for (int i = 0; i < (int) tests.size(); i++) {
+    if (!results[i].passed) {
+      cout << endl << "--- Output of " << tests[i].name << endl;
+      cout << results[i].output << endl;
+      failures++;
+    }
+  }
+
+  cout << tests.size() - failures << " of " << tests.size() << " tests passed" << endl;
+  return failures == 0;
+}
+
+vector<TestCase> allTests() {
+  vector<TestCase> tests;
+
+  tests.push_back({"rvc", []() {
     TLU t = parseTLU("./rv.iv");
     Context c;
     lowerTLU(c, t);
@@ -74,9 +648,29 @@ int main() {
     
     emitVerilog(c, m);
     assert(runIVerilogTB("rvc"));
-  }
+  }});
+
+  tests.push_back({"rvc_parallel_muxes", []() {
+    TLU t = parseTLU("./rv.iv");
+    Context c;
+    lowerTLU(c, t);
+
+    auto m = c.getModule("rvc");
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);
+    synthesizeChannels(m);
+    reduceStructures(m);
+    deleteNoEffectInstructions(m);    
+    deleteDeadResources(m);
+
+    VerilogEmitOptions options;
+    options.parallelMuxes = true;
+    emitVerilog(c, m, options);
+    assert(runIVerilogTB("rvc"));
+  }});
  
-  {
+  tests.push_back({"toggle", []() {
     TLU t = parseTLU("./toggle.iv");
     Context c;
    lowerTLU(c, t);
@@ -94,15 +688,90 @@ int main() {
    
    emitVerilog(c, m);
    assert(runIVerilogTB("toggle"));
-  }
+  }});
+
+  tests.push_back({"rvc_incremental", []() {
+    auto compile = [](Context& c, Module* m) {
+      inlineInvokes(m);
+      synthesizeDelays(m);
+      deleteNoEffectInstructions(m);
+      synthesizeChannels(m);
+      reduceStructures(m);
+      deleteNoEffectInstructions(m);
+      deleteDeadResources(m);
+
+      emitVerilog(c, m);
+    };
+
+    auto readFile = [](const string& path) {
+      ifstream in(path);
+      return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    };
+
+    auto writeFile = [](const string& path, const string& contents) {
+      ofstream out(path);
+      out << contents;
+    };
+
+    int removed = system("rm -f rv_fingerprints.txt");
+    assert(removed == 0);
+
+    string passes = "inline delays channels structures dead";
+    auto recompiled = compileIncremental("./rv.iv", "rv_fingerprints.txt", passes, compile);
+    assert(recompiled == set<string>{"rvc"});
+
+    recompiled = compileIncremental("./rv.iv", "rv_fingerprints.txt", passes, compile);
+    assert(recompiled.size() == 0);
+
+    // Comments and whitespace do not invalidate anything
+    string src = readFile("./rv.iv");
+    string reformatted = src + "// trailing comment\n";
+    reformatted.insert(reformatted.find("default ready_en = 0;"), "\n  // Not ready until started\n");
+    writeFile("rv_edited.iv", reformatted);
+    recompiled = compileIncremental("./rv_edited.iv", "rv_fingerprints.txt", passes, compile);
+    assert(recompiled.size() == 0);
+
+    // Changing the passes invalidates every module
+    recompiled = compileIncremental("./rv.iv", "rv_fingerprints.txt", passes + " fold", compile);
+    assert(recompiled == set<string>{"rvc"});
+
+    string edited = src;
+    edited.replace(edited.find("default ready_en = 0;"), string("default ready_en = 0;").size(), "default ready_en = 1;");
+    writeFile("rv_edited.iv", edited);
+    recompiled = compileIncremental("./rv_edited.iv", "rv_fingerprints.txt", passes, compile);
+    assert(recompiled == set<string>{"rvc"});
+
+    // Back to the original for the simulation
+    recompiled = compileIncremental("./rv.iv", "rv_fingerprints.txt", passes, compile);
+    assert(recompiled == set<string>{"rvc"});
+
+    // Edits to reg1 reach toggle through its reg1 resource, edits to
+    // toggle leave reg1 alone
+    string toggleSrc = readFile("./toggle.iv");
+    auto original = moduleFingerprints(parseTLU("./toggle.iv"), passes);
+
+    string reg1Edited = toggleSrc;
+    reg1Edited.replace(reg1Edited.find("default en = 0;"), string("default en = 0;").size(), "default en = 1;");
+    writeFile("toggle_edited.iv", reg1Edited);
+    auto afterReg1Edit = moduleFingerprints(parseTLU("./toggle_edited.iv"), passes);
+    assert(afterReg1Edit["reg1"] != original["reg1"]);
+    assert(afterReg1Edit["toggle"] != original["toggle"]);
+
+    string toggleEdited = toggleSrc;
+    toggleEdited.insert(toggleEdited.find("assign value = v.data;"), "default toggle = 0;\n");
+    writeFile("toggle_edited.iv", toggleEdited);
+    auto afterToggleEdit = moduleFingerprints(parseTLU("./toggle_edited.iv"), passes);
+    assert(afterToggleEdit["reg1"] == original["reg1"]);
+    assert(afterToggleEdit["toggle"] != original["toggle"]);
 
-  {
-    Context c;
+    assert(runIVerilogTB("rvc"));
+  }});
 
-    addBinop(c, "add16", 0);
+  tests.push_back({"add_16_wrapper", []() {
+    Context c;
 
-    Module* add16 = c.getModule("add16");
-    Module* add16Inv = add16->action("add16_apply");
+    Module* add16 = getBinopMod(c, "add", 16);
+    Module* add16Inv = add16->action("add_16_apply");
 
     Module* addWrapper = c.addModule("add_16_wrapper");
     addWrapper->addInPort(16, "in0");
@@ -114,9 +783,9 @@ int main() {
     CC* callAdd = addWrapper->addInvokeInstruction(add16Inv);
     callAdd->setIsStartAction(true);
   
-    callAdd->bind("add16_in0", mAdd->pt("in0"));
-    callAdd->bind("add16_in1", mAdd->pt("in1"));
-    callAdd->bind("add16_out", mAdd->pt("out"));
+    callAdd->bind("add_16_in0", mAdd->pt("in0"));
+    callAdd->bind("add_16_in1", mAdd->pt("in1"));
+    callAdd->bind("add_16_out", mAdd->pt("out"));
 
     callAdd->bind("in0", addWrapper->ipt("in0"));
     callAdd->bind("in1", addWrapper->ipt("in1"));
@@ -141,14 +810,338 @@ int main() {
     // std::string str((std::istreambuf_iterator<char>(t)),
     //                 std::istreambuf_iterator<char>());
     
-  }
+  }});
 
-  {
+  tests.push_back({"hierarchy_dedup", []() {
     Context c;
-    addBinop(c, "add16", 0);
-    
-    Module* add16 = c.getModule("add16");
-    Module* add16Apply = c.getModule("add16_apply");
+    Module* reg8 = getRegMod(c, 8);
+
+    // Latches in when started and finishes delay cycles after enabling r
+    auto addChild = [&c, reg8](const string& name, const int delay) {
+      Module* child = c.addModule(name);
+      child->addInPort(8, "in");
+      child->addOutPort(8, "out");
+      auto r = child->addInstance(reg8, "r");
+      child->addSC(child->ipt("out"), r->pt("data"));
+
+      CC* load = child->addStartInstruction(child->ipt("in"), r->pt("in"));
+      CC* enable = child->addInstruction(child->c(1, 1), r->pt("en"));
+      CC* done = child->addEmptyInstruction();
+      load->continueTo(child->c(1, 1), enable, 0);
+      enable->continueTo(child->c(1, 1), done, delay);
+      return child;
+    };
+
+    // child_b is child_a under another name, child_c differs only in its
+    // control graph
+    Module* top = c.addModule("dedup_top");
+    top->addInstance(addChild("child_a", 1), "a");
+    top->addInstance(addChild("child_b", 1), "b");
+    top->addInstance(addChild("child_c", 0), "c");
+
+    std::ostringstream out;
+    emitVerilogHierarchy(c, top, out, VerilogEmitOptions());
+    string verilog = out.str();
+
+    assert(verilog.find("module child_a(") != string::npos);
+    assert(verilog.find("module child_b(") == string::npos);
+    assert(verilog.find("module child_c(") != string::npos);
+    assert(verilog.find("module dedup_top(") != string::npos);
+    assert(verilog.find("child_a b(") != string::npos);
+    assert(verilog.find("child_c c(") != string::npos);
+
+    // Only the top gets profile counters, and its single counter is read
+    // through a one bit address
+    VerilogEmitOptions profiled;
+    profiled.profileCounters = true;
+    std::ostringstream profiledOut;
+    emitVerilogHierarchy(c, top, profiledOut, profiled);
+    string profiledVerilog = profiledOut.str();
+
+    // Children are emitted before the top
+    size_t addrPort = profiledVerilog.find("debug_counter_addr");
+    assert(addrPort != string::npos);
+    assert(addrPort > profiledVerilog.find("module dedup_top("));
+    assert(profiledVerilog.find("input [0 : 0] debug_counter_addr") != string::npos);
+    assert(profiledVerilog.find("debug_counter_addr < 1 ?") != string::npos);
+  }});
+
+  tests.push_back({"delete_unreachable_instructions", []() {
+    Context c;
+    Module* reg8 = getRegMod(c, 8);
+
+    Module* m = c.addModule("delete_unreachable_instructions");
+    m->addInPort(8, "in");
+    m->addOutPort(8, "out");
+
+    auto kept = m->addInstance(reg8, "kept");
+    m->addSC(m->ipt("out"), kept->pt("data"));
+    CC* start = m->addStartInstruction(m->ipt("in"), kept->pt("in"));
+    CC* done = m->addEmptyInstruction();
+    start->continueTo(m->c(1, 1), done, 1);
+
+    // never is only written behind a constant 0 condition, and orphan only
+    // by a CC that nothing jumps to
+    auto never = m->addInstance(reg8, "never");
+    CC* writeNever = m->addCC(never->pt("in"), m->ipt("in"));
+    start->continueTo(m->c(1, 0), writeNever, 1);
+
+    auto orphan = m->addInstance(reg8, "orphan");
+    m->addCC(orphan->pt("in"), m->ipt("in"));
+
+    deleteUnreachableInstructions(m);
+
+    assert(m->getBody().size() == 2);
+    assert(elem(start, m->getBody()));
+    assert(elem(done, m->getBody()));
+    assert(start->continuations.size() == 1);
+    assert(start->continuations[0].destination == done);
+
+    set<string> resources;
+    for (auto r : m->getResources()) {
+      resources.insert(r->getName());
+      assert(!(isConstant(r) && constantValue(r) == 0));
+    }
+    assert(elem(string("kept"), resources));
+    assert(!elem(string("never"), resources));
+    assert(!elem(string("orphan"), resources));
+  }});
+
+  tests.push_back({"delete_no_effect_chain", []() {
+    Context c;
+    Module* reg8 = getRegMod(c, 8);
+
+    Module* m = c.addModule("delete_no_effect_chain");
+    m->addInPort(8, "in");
+
+    // Deleting last leaves middle with nothing to do, so it goes too, and
+    // start is left with no activations to either
+    auto r = m->addInstance(reg8, "r");
+    CC* start = m->addStartInstruction(m->ipt("in"), r->pt("in"));
+    CC* middle = m->addEmptyInstruction();
+    CC* last = m->addEmptyInstruction();
+    start->continueTo(m->c(1, 1), middle, 1);
+    middle->continueTo(m->c(1, 1), last, 1);
+
+    deleteNoEffectInstructions(m);
+
+    assert(m->getBody().size() == 1);
+    assert(elem(start, m->getBody()));
+    for (auto instr : m->getBody()) {
+      for (auto act : instr->continuations) {
+        assert(elem(act.destination, m->getBody()));
+      }
+    }
+    assert(start->continuations.size() == 0);
+  }});
+
+  tests.push_back({"estimate_reg_add_reg", []() {
+    Context c;
+    Module* add16 = getBinopMod(c, "add", 16);
+    Module* reg16 = getRegMod(c, 16);
+
+    Module* m = c.addModule("estimate_reg_add_reg");
+    m->addInPort(16, "in_data");
+
+    auto a = m->addInstanceSeq(reg16, "a");
+    auto b = m->addInstanceSeq(reg16, "b");
+    auto r = m->addInstanceSeq(reg16, "r");
+    auto sum = m->addInstance(add16, "sum");
+    m->addSC(sum->pt("in0"), a->pt("data"));
+    m->addSC(sum->pt("in1"), b->pt("data"));
+
+    // Four CCs set r.in, so it gets an 8 input mux, which takes two LUT
+    // levels
+    CC* s0 = m->addStartInstruction(sum->pt("out"), r->pt("in"));
+    CC* s1 = m->addCC(m->ipt("in_data"), r->pt("in"));
+    CC* s2 = m->addCC(a->pt("data"), r->pt("in"));
+    CC* s3 = m->addCC(b->pt("data"), r->pt("in"));
+    s0->continueTo(m->c(1, 1), s1, 1);
+    s1->continueTo(m->c(1, 1), s2, 1);
+    s2->continueTo(m->c(1, 1), s3, 1);
+
+    ModuleEstimate est = estimateModule(m);
+    cout << est;
+
+    // Three registers plus one happened flop per CC
+    assert(est.flops == 3*16 + 4);
+
+    // The adder, one LUT to OR together the activations of each CC, and
+    // two LUTs per bit of the mux in front of r.in
+    assert(est.luts == 16 + 4 + 16*2);
+
+    assert(est.criticalPath == operatorDelay("add", 16) + 2);
+    assert(est.criticalPathNodes.size() == 3);
+    assert(est.criticalPathNodes[0] == sum->pt("in0").toString() ||
+           est.criticalPathNodes[0] == sum->pt("in1").toString());
+    assert(est.criticalPathNodes[1] == sum->pt("out").toString());
+    assert(est.criticalPathNodes[2] == r->pt("in").toString());
+    assert(est.blackBoxes.empty());
+  }});
+
+  tests.push_back({"emit_verilog_concurrently", []() {
+    Context c;
+    auto buildModule = [&c](const int width) {
+      Module* add = getBinopMod(c, "add", width);
+      Module* reg = getRegMod(c, width);
+
+      Module* m = c.addModule("emit_concurrently_" + to_string(width));
+      m->addInPort(width, "in_data");
+      m->addInPort(1, "go");
+
+      auto a = m->addInstanceSeq(reg, "a");
+      auto r = m->addInstanceSeq(reg, "r");
+      auto sum = m->addInstance(add, "sum");
+      m->addSC(sum->pt("in0"), a->pt("data"));
+      m->addSC(sum->pt("in1"), m->ipt("in_data"));
+
+      CC* s0 = m->addStartInstruction(sum->pt("out"), r->pt("in"));
+      CC* s1 = m->addCC(m->ipt("in_data"), a->pt("in"));
+      CC* s2 = m->addCC(a->pt("data"), r->pt("in"));
+      s0->continueTo(m->c(1, 1), s1, 1);
+      s1->continueTo(m->ipt("go"), s2, 1);
+      return m;
+    };
+    Module* m8 = buildModule(8);
+    Module* m16 = buildModule(16);
+
+    // Emitting into a stream must not print anything else
+    std::ostringstream printed;
+    std::streambuf* coutBuf = cout.rdbuf(printed.rdbuf());
+    string expected8 = emitVerilogString(c, m8, VerilogEmitOptions());
+    string expected16 = emitVerilogString(c, m16, VerilogEmitOptions());
+    cout.rdbuf(coutBuf);
+    assert(printed.str() == "");
+
+    string emitted8, emitted16;
+    thread t8([&]() { emitted8 = emitVerilogString(c, m8, VerilogEmitOptions()); });
+    thread t16([&]() { emitted16 = emitVerilogString(c, m16, VerilogEmitOptions()); });
+    t8.join();
+    t16.join();
+
+    assert(emitted8 == expected8);
+    assert(emitted16 == expected16);
+    assert(expected8 != expected16);
+  }});
+
+  tests.push_back({"channel_through_diamonds", []() {
+    Context c;
+    Module* chanMod = getChannelMod(c, 16);
+
+    // The channel is written once, then crosses four diamonds before it is
+    // read, so the read is reached along 16 paths
+    Module* m = c.addModule("channel_through_diamonds");
+    m->addInPort(16, "in");
+    m->addOutPort(16, "out");
+    Port one = m->c(1, 1);
+
+    ModuleInstance* chan = m->addInstance(chanMod, "chan");
+    CC* last = m->addStartInstruction(chan->pt("in"), m->ipt("in"));
+    for (int i = 0; i < 4; i++) {
+      CC* left = m->addEmptyInstruction();
+      CC* right = m->addEmptyInstruction();
+      CC* join = m->addEmptyInstruction();
+      last->continueTo(one, left, 1);
+      last->continueTo(one, right, 1);
+      left->continueTo(one, join, 1);
+      right->continueTo(one, join, 1);
+      last = join;
+    }
+    CC* read = m->addCC(m->ipt("out"), chan->pt("out"));
+    last->continueTo(one, read, 1);
+
+    synthesizeChannels(m);
+
+    // One register per cycle boundary the value crosses, and no reference
+    // to the channel left behind
+    int registers = 0;
+    for (auto r : m->getResources()) {
+      assert(r != chan);
+      if (r->source->getName() == getRegMod(c, 16)->getName()) {
+        registers++;
+      }
+    }
+    assert(registers == 13);
+
+    // The 14 original instructions plus one inlined store of 5 CCs per
+    // register
+    assert(m->getBody().size() == 14 + 5 * 13);
+
+    for (auto instr : m->getBody()) {
+      for (auto pt : allReferencedPorts(instr)) {
+        assert(pt.inst != chan);
+      }
+    }
+  }});
+
+  tests.push_back({"emit_to_output_dir", []() {
+    Context c;
+    Module* reg8 = getRegMod(c, 8);
+
+    Module* m = c.addModule("emit_to_output_dir");
+    m->addInPort(8, "in");
+    m->addOutPort(8, "out");
+    auto r = m->addInstance(reg8, "r");
+    m->addSC(m->ipt("out"), r->pt("data"));
+
+    CC* load = m->addStartInstruction(m->ipt("in"), r->pt("in"));
+    CC* enable = m->addInstruction(m->c(1, 1), r->pt("en"));
+    load->continueTo(m->c(1, 1), enable, 0);
+
+    char dirTemplate[] = "/tmp/cac_emit_XXXXXX";
+    char* tmp = mkdtemp(dirTemplate);
+    assert(tmp != nullptr);
+    string dir = tmp;
+
+    VerilogEmitOptions options;
+    options.outputDir = dir + "/";
+    assert(verilogFileName(m, options) == dir + "/emit_to_output_dir.v");
+    options.outputDir = dir;
+    assert(verilogFileName(m, options) == dir + "/emit_to_output_dir.v");
+
+    emitVerilog(c, m, options);
+
+    // Nothing is written to the current directory
+    ifstream local("emit_to_output_dir.v");
+    assert(!local);
+
+    ifstream in(dir + "/emit_to_output_dir.v");
+    assert(in);
+    string contents((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    string emitted = emitVerilogString(c, m, options);
+    assert(emitted.find("module emit_to_output_dir(") != string::npos);
+    assert(contents == emitted);
+
+    runCmd("rm -rf " + dir);
+  }});
+
+  tests.push_back({"fold_all_ones", []() {
+    Context c;
+    Module* sub32 = getBinopMod(c, "sub", 32);
+
+    // 0 - 1 folds to a 32 bit constant with the top bit set
+    Module* m = c.addModule("fold_all_ones");
+    m->addOutPort(32, "out");
+    auto s = m->addInstance(sub32, "s");
+    m->addSC(s->pt("in0"), m->addInstance(getConstMod(c, 32, 0), "zero")->pt("out"));
+    m->addSC(s->pt("in1"), m->addInstance(getConstMod(c, 32, 1), "one")->pt("out"));
+    m->addSC(m->ipt("out"), s->pt("out"));
+    m->addEmptyInstruction()->setIsStartAction(true);
+
+    foldConstants(m);
+
+    for (auto r : m->getResources()) {
+      assert(r->source != sub32);
+    }
+    string verilog = emitVerilogString(c, m, VerilogEmitOptions());
+    assert(verilog.find("32'd4294967295") != string::npos);
+    assert(verilog.find("'d-") == string::npos);
+  }});
+
+  tests.push_back({"pipelined_adds", []() {
+    Context c;
+    Module* add16 = getBinopMod(c, "add", 16);
+    Module* add16Apply = c.getModule("add_16_apply");
     Module* one16 = getConstMod(c, 16, 1);
     Module* const_1_1 = getConstMod(c, 1, 1);
     Module* w16 = getWireMod(c, 16);
@@ -176,9 +1169,9 @@ int main() {
     firstAdd->bind("in1", c16->pt("out"));
     firstAdd->bind("out", add1Wire->pt("in"));
 
-    firstAdd->bind("add16_in0", add1->pt("in0"));
-    firstAdd->bind("add16_in1", add1->pt("in1"));
-    firstAdd->bind("add16_out", add1->pt("out"));
+    firstAdd->bind("add_16_in0", add1->pt("in0"));
+    firstAdd->bind("add_16_in1", add1->pt("in1"));
+    firstAdd->bind("add_16_out", add1->pt("out"));
 
     CC* storeFirstRes =
       pipeAdds->addInvokeInstruction(reg16->action("reg_16_st"));
@@ -194,9 +1187,9 @@ int main() {
     secondAdd->bind("in1", c16->pt("out"));
     secondAdd->bind("out", pipeAdds->ipt("result"));
 
-    secondAdd->bind("add16_in0", add2->pt("in0"));
-    secondAdd->bind("add16_in1", add2->pt("in1"));
-    secondAdd->bind("add16_out", add2->pt("out"));
+    secondAdd->bind("add_16_in0", add2->pt("in0"));
+    secondAdd->bind("add_16_in1", add2->pt("in1"));
+    secondAdd->bind("add_16_out", add2->pt("out"));
 
     entryCheck->continueTo(oneInst->pt("out"), entryCheck, 1);
     entryCheck->continueTo(pipeAdds->ipt("in_valid"), firstAdd, 0);
@@ -216,17 +1209,15 @@ int main() {
     emitVerilog(c, pipeAdds);
     assert(runIVerilogTB(pipeAdds->getName()));
     //runCmd("iverilog -o tb tb_pipelined_adds.v pipelined_adds.v builtins.v");
-  }
+  }});
 
-  {
+  tests.push_back({"channel_pipelined_adds", []() {
     // Now: Example of signals
     //  - Implement two pipelined adders with signal between them instead of
     //    an explicit register
     Context c;
-    addBinop(c, "add16", 0);
-    
-    Module* add16 = c.getModule("add16");
-    Module* add16Apply = c.getModule("add16_apply");
+    Module* add16 = getBinopMod(c, "add", 16);
+    Module* add16Apply = c.getModule("add_16_apply");
     Module* one16 = getConstMod(c, 16, 1);
     Module* const_1_1 = getConstMod(c, 1, 1);
     //Module* w16 = getWireMod(c, 16);
@@ -254,9 +1245,9 @@ int main() {
     firstAdd->bind("in1", c16->pt("out"));
     firstAdd->bind("out", chan->pt("in"));
 
-    firstAdd->bind("add16_in0", add1->pt("in0"));
-    firstAdd->bind("add16_in1", add1->pt("in1"));
-    firstAdd->bind("add16_out", add1->pt("out"));
+    firstAdd->bind("add_16_in0", add1->pt("in0"));
+    firstAdd->bind("add_16_in1", add1->pt("in1"));
+    firstAdd->bind("add_16_out", add1->pt("out"));
     
     CC* secondAdd = pipeAdds->addInvokeInstruction(add16Apply);
 
@@ -265,9 +1256,9 @@ int main() {
     secondAdd->bind("in1", c16->pt("out"));
     secondAdd->bind("out", pipeAdds->ipt("result"));
 
-    secondAdd->bind("add16_in0", add2->pt("in0"));
-    secondAdd->bind("add16_in1", add2->pt("in1"));
-    secondAdd->bind("add16_out", add2->pt("out"));
+    secondAdd->bind("add_16_in0", add2->pt("in0"));
+    secondAdd->bind("add_16_in1", add2->pt("in1"));
+    secondAdd->bind("add_16_out", add2->pt("out"));
 
     entryCheck->continueTo(oneInst->pt("out"), entryCheck, 1);
     entryCheck->continueTo(pipeAdds->ipt("in_valid"), firstAdd, 0);
@@ -289,17 +1280,15 @@ int main() {
 
     cout << "Checking simple channel..." << endl;
     assert(runIVerilogTB(pipeAdds->getName()));
-  }
+  }});
 
-  {
+  tests.push_back({"structure_reduce_channel_pipelined_adds", []() {
     // Now: Example of signals
     //  - Implement two pipelined adders with signal between them instead of
     //    an explicit register
     Context c;
-    addBinop(c, "add16", 0);
-    
-    Module* add16 = c.getModule("add16");
-    Module* add16Apply = c.getModule("add16_apply");
+    Module* add16 = getBinopMod(c, "add", 16);
+    Module* add16Apply = c.getModule("add_16_apply");
     Module* one16 = getConstMod(c, 16, 1);
     Module* const_1_1 = getConstMod(c, 1, 1);
     //Module* w16 = getWireMod(c, 16);
@@ -327,9 +1316,9 @@ int main() {
     firstAdd->bind("in1", c16->pt("out"));
     firstAdd->bind("out", chan->pt("in"));
 
-    firstAdd->bind("add16_in0", add1->pt("in0"));
-    firstAdd->bind("add16_in1", add1->pt("in1"));
-    firstAdd->bind("add16_out", add1->pt("out"));
+    firstAdd->bind("add_16_in0", add1->pt("in0"));
+    firstAdd->bind("add_16_in1", add1->pt("in1"));
+    firstAdd->bind("add_16_out", add1->pt("out"));
     
     CC* secondAdd = pipeAdds->addInvokeInstruction(add16Apply);
 
@@ -338,9 +1327,9 @@ int main() {
     secondAdd->bind("in1", c16->pt("out"));
     secondAdd->bind("out", pipeAdds->ipt("result"));
 
-    secondAdd->bind("add16_in0", add2->pt("in0"));
-    secondAdd->bind("add16_in1", add2->pt("in1"));
-    secondAdd->bind("add16_out", add2->pt("out"));
+    secondAdd->bind("add_16_in0", add2->pt("in0"));
+    secondAdd->bind("add_16_in1", add2->pt("in1"));
+    secondAdd->bind("add_16_out", add2->pt("out"));
 
     entryCheck->continueTo(oneInst->pt("out"), entryCheck, 1);
     entryCheck->continueTo(pipeAdds->ipt("in_valid"), firstAdd, 0);
@@ -360,9 +1349,9 @@ int main() {
   
     emitVerilog(c, pipeAdds);
     assert(runIVerilogTB(pipeAdds->getName()));
-  }
+  }});
 
-  {
+  tests.push_back({"read_write_ram", []() {
     runCmd("clang -S -emit-llvm ./c_files/read_write_ram.c -c -O3");
 
     Context c;
@@ -382,9 +1371,9 @@ int main() {
     
     emitVerilog(c, m);
     assert(runIVerilogTB(m->getName()));
-  }
+  }});
 
-  {
+  tests.push_back({"read_add_2_ram", []() {
     runCmd("clang -S -emit-llvm ./c_files/read_add_2_ram.c -c -O3");
 
     Context c;
@@ -401,12 +1390,523 @@ int main() {
     deleteNoEffectInstructions(m);        
     synthesizeChannels(m);
     reduceStructures(m);
+    foldConstants(m);
     deleteNoEffectInstructions(m);    
     deleteDeadResources(m);
 
     emitVerilog(c, m);
     assert(runIVerilogTB(m->getName()));
-  }
+  }});
+
+  tests.push_back({"int_ops", []() {
+    runCmd("clang -S -emit-llvm ./c_files/int_ops.c -c -O3");
+
+    Context c;
+    loadLLVMFromFile(c, "int_ops", "./int_ops.ll");
+
+    Module* m = c.getModule("int_ops");
+    assert(m != nullptr);
+
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);
+    synthesizeChannels(m);
+    reduceStructures(m);
+    foldConstants(m);
+    deleteNoEffectInstructions(m);
+    deleteUnreachableInstructions(m);
+
+    // Each operator gets its own builtin. The predicates are not checked
+    // here because clang may invert a comparison and swap the branch
+    // targets, but the testbench checks every result.
+    auto usesBuiltin = [m](const string& verilogMod) {
+      for (auto r : m->getResources()) {
+        if (r->source->getVerilogDeclString().find(verilogMod + " #") == 0) {
+          return true;
+        }
+      }
+      return false;
+    };
+    for (string op : {"sdivPipe", "udivPipe", "sremPipe", "uremPipe",
+          "xorOp", "shlOp", "lshrOp", "ashrOp"}) {
+      assert(usesBuiltin(op));
+    }
+
+    emitVerilog(c, m);
+    assert(runIVerilogTB(m->getName()));
+  }});
+
+  tests.push_back({"posted_writes", []() {
+    runCmd("clang -S -emit-llvm ./c_files/posted_writes.c -c -O3");
+
+    Context c;
+    loadLLVMFromFile(c, "posted_writes", "./posted_writes.ll");
+
+    Module* m = c.getModule("posted_writes");
+    assert(m != nullptr);
+
+    // Cycle each CC starts in, along the quickest path from a start action
+    map<CC*, int> startCycle;
+    vector<CC*> toVisit;
+    for (auto instr : m->getBody()) {
+      if (instr->isStartAction) {
+        startCycle[instr] = 0;
+        toVisit.push_back(instr);
+      }
+    }
+    while (toVisit.size() > 0) {
+      CC* instr = toVisit.back();
+      toVisit.pop_back();
+      for (auto act : instr->continuations) {
+        int cycle = map_find(instr, startCycle) + act.delay;
+        if (!contains_key(act.destination, startCycle) ||
+            cycle < map_find(act.destination, startCycle)) {
+          startCycle[act.destination] = cycle;
+          toVisit.push_back(act.destination);
+        }
+      }
+    }
+
+    // Accesses as r<address> or w<address>, in the order they are issued
+    map<int, string> accesses;
+    set<string> posted;
+    for (auto instr : m->getBody()) {
+      if (!instr->isInvoke()) {
+        continue;
+      }
+
+      string action = instr->invokedModule()->getName();
+      bool isRead = hasPrefix(action, "ram_32_128_read");
+      if (!isRead && !hasPrefix(action, "ram_32_128_write")) {
+        continue;
+      }
+
+      Port addr = map_find(string(isRead ? "raddr_0" : "waddr_0"), instr->invokedBinding());
+      string access = (isRead ? "r" : "w") + to_string(constantValue(addr.inst));
+      assert(contains_key(instr, startCycle));
+      assert(!contains_key(map_find(instr, startCycle), accesses));
+      accesses[map_find(instr, startCycle)] = access;
+      if (action.find("_posted") != string::npos) {
+        posted.insert(access);
+      }
+    }
+
+    vector<string> order;
+    for (auto access : accesses) {
+      order.push_back(access.second);
+    }
+    assert(order == vector<string>({"r0", "r1", "w4", "r4", "r2", "r3", "w5", "w6"}));
+    assert(posted == set<string>({"w5"}));
+
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);
+    synthesizeChannels(m);
+    reduceStructures(m);
+    foldConstants(m);
+    deleteNoEffectInstructions(m);
+    deleteUnreachableInstructions(m);
+
+    emitVerilog(c, m);
+    assert(runIVerilogTB(m->getName()));
+  }});
+
+  tests.push_back({"read_add_2_loop_ssa", []() {
+    // At -O3 the loop counter is a PHI node rather than an alloca
+    runCmd("clang -S -emit-llvm ./c_files/read_add_2_loop_ssa.c -c -O3");
+
+    Context c;
+    loadLLVMFromFile(c, "read_add_2_loop_ssa", "./read_add_2_loop_ssa.ll");
+
+    Module* m = c.getModule("read_add_2_loop_ssa");
+    assert(m != nullptr);
+
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);        
+    synthesizeChannels(m);
+    reduceStructures(m);
+    foldConstants(m);
+    deleteNoEffectInstructions(m);    
+    deleteUnreachableInstructions(m);
+
+    emitVerilog(c, m);
+    assert(runIVerilogTB(m->getName()));
+  }});
+
+  tests.push_back({"add_3_rams", []() {
+    runCmd("clang -S -emit-llvm ./c_files/add_3_rams.c -c -O3");
+
+    Context c;
+    loadLLVMFromFile(c, "add_3_rams", "./add_3_rams.ll");
+
+    Module* m = c.getModule("add_3_rams");
+    assert(m != nullptr);
+
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);        
+    synthesizeChannels(m);
+    reduceStructures(m);
+    foldConstants(m);
+    deleteNoEffectInstructions(m);    
+    deleteUnreachableInstructions(m);
+
+    emitVerilog(c, m);
+    assert(runIVerilogTB(m->getName()));
+  }});
+
+  tests.push_back({"read_add_2_loop_banked", []() {
+    runCmd("clang -S -emit-llvm ./c_files/read_add_2_loop_banked.c -c -O3");
+
+    // Split the memory into even and odd words
+    LLVMLoadOptions options;
+    options.partitions["ram"] = PartitionSpec("cyclic", 2);
+
+    Context c;
+    loadLLVMFromFile(c, "read_add_2_loop_banked", "./read_add_2_loop_banked.ll", options);
+
+    Module* m = c.getModule("read_add_2_loop_banked");
+    assert(m != nullptr);
+
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);        
+    synthesizeChannels(m);
+    reduceStructures(m);
+    foldConstants(m);
+    deleteNoEffectInstructions(m);    
+    deleteUnreachableInstructions(m);
+
+    emitVerilog(c, m);
+    assert(runIVerilogTB(m->getName()));
+  }});
+
+  tests.push_back({"read_add_2_loop_unrolled", []() {
+    runCmd("clang -S -emit-llvm ./c_files/read_add_2_loop_unrolled.c -c -O3");
+
+    LLVMLoadOptions options;
+    options.unrollFactors["read_add_2_loop_unrolled"] = 2;
+
+    Context c;
+    loadLLVMFromFile(c, "read_add_2_loop_unrolled", "./read_add_2_loop_unrolled.ll", options);
+
+    Module* m = c.getModule("read_add_2_loop_unrolled");
+    assert(m != nullptr);
+
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);        
+    synthesizeChannels(m);
+    reduceStructures(m);
+    foldConstants(m);
+    deleteNoEffectInstructions(m);    
+    deleteUnreachableInstructions(m);
+
+    emitVerilog(c, m);
+    assert(runIVerilogTB(m->getName()));
+  }});
+
+  tests.push_back({"read_add_2_loop_unrolled_shared_adder", []() {
+    runCmd("clang -S -emit-llvm ./c_files/read_add_2_loop_unrolled.c -c -O3");
+
+    // Every addition in the unrolled body goes through one adder
+    LLVMLoadOptions options;
+    options.unrollFactors["read_add_2_loop_unrolled"] = 2;
+    options.unitLimits["add"] = 1;
+
+    Context c;
+    loadLLVMFromFile(c, "read_add_2_loop_unrolled", "./read_add_2_loop_unrolled.ll", options);
+
+    Module* m = c.getModule("read_add_2_loop_unrolled");
+    assert(m != nullptr);
+
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);
+    synthesizeChannels(m);
+    reduceStructures(m);
+    foldConstants(m);
+    deleteNoEffectInstructions(m);
+    deleteUnreachableInstructions(m);
+
+    emitVerilog(c, m);
+    assert(runIVerilogTB(m->getName()));
+  }});
+
+  tests.push_back({"stream_add_2", []() {
+    runCmd("clang -S -emit-llvm ./c_files/stream_add_2.c -c -O3");
+
+    Context c;
+    loadLLVMFromFile(c, "stream_add_2", "./stream_add_2.ll");
+
+    Module* m = c.getModule("stream_add_2");
+    assert(m != nullptr);
+
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);
+    synthesizeChannels(m);
+    reduceStructures(m);
+    foldConstants(m);
+    deleteNoEffectInstructions(m);
+    deleteUnreachableInstructions(m);
+
+    emitVerilog(c, m);
+    assert(runIVerilogTB(m->getName()));
+  }});
+
+  tests.push_back({"axi_add_2", []() {
+    runCmd("clang -S -emit-llvm ./c_files/axi_add_2.c -c -O3");
+
+    Context c;
+    loadLLVMFromFile(c, "axi_add_2", "./axi_add_2.ll");
+
+    Module* m = c.getModule("axi_add_2");
+    assert(m != nullptr);
+
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);
+    synthesizeChannels(m);
+    reduceStructures(m);
+    foldConstants(m);
+    deleteNoEffectInstructions(m);
+    deleteUnreachableInstructions(m);
+
+    emitVerilog(c, m);
+    assert(runIVerilogTB(m->getName()));
+  }});
+
+  tests.push_back({"axi_add_2_list_scheduled", []() {
+    runCmd("clang -S -emit-llvm ./c_files/axi_add_2.c -c -O3");
+
+    // The additions of the unrolled loop run two per cycle on two adders
+    LLVMLoadOptions options;
+    options.listSchedule = true;
+    options.resourceLimits["add_*"] = 2;
+    options.unitLimits["add"] = 2;
+
+    Context c;
+    loadLLVMFromFile(c, "axi_add_2", "./axi_add_2.ll", options);
+
+    Module* m = c.getModule("axi_add_2");
+    assert(m != nullptr);
+
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);
+    synthesizeChannels(m);
+    reduceStructures(m);
+    foldConstants(m);
+    deleteNoEffectInstructions(m);
+    deleteUnreachableInstructions(m);
+
+    emitVerilog(c, m);
+    assert(runIVerilogTB(m->getName()));
+  }});
+
+  tests.push_back({"alloca_round_trip_list_scheduled", []() {
+    // At -O0 the locals are allocas, so each load must wait for the store
+    // before it
+    runCmd("clang -S -emit-llvm ./c_files/alloca_round_trip.c -c -O0");
+
+    LLVMLoadOptions options;
+    options.listSchedule = true;
+
+    Context c;
+    loadLLVMFromFile(c, "alloca_round_trip", "./alloca_round_trip.ll", options);
+
+    Module* m = c.getModule("alloca_round_trip");
+    assert(m != nullptr);
+
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);
+    synthesizeChannels(m);
+    reduceStructures(m);
+    foldConstants(m);
+    deleteNoEffectInstructions(m);
+    deleteUnreachableInstructions(m);
+
+    emitVerilog(c, m);
+    assert(runIVerilogTB(m->getName()));
+  }});
+
+  tests.push_back({"read_add_2_loop_ssa_narrowed", []() {
+    runCmd("clang -S -emit-llvm ./c_files/read_add_2_loop_ssa.c -c -O3");
+
+    // With narrowing the counter, its increment and the exit comparison
+    // are 5 bits. The memory address ports always match the depth.
+    for (bool narrow : {true, false}) {
+      LLVMLoadOptions options;
+      options.narrowWidths = narrow;
+
+      Context c;
+      loadLLVMFromFile(c, "read_add_2_loop_ssa", "./read_add_2_loop_ssa.ll", options);
+
+      Module* m = c.getModule("read_add_2_loop_ssa");
+      assert(m != nullptr);
+
+      string counterWidth = narrow ? "5" : "32";
+      int phis = 0;
+      int comparators = 0;
+      for (auto r : m->getResources()) {
+        if (hasPrefix(r->getName(), "phi")) {
+          assert(r->pt("data").getWidth() == stoi(counterWidth));
+          phis++;
+        }
+        if (r->source->getVerilogDeclString().find("eq #") == 0) {
+          assert(r->source->getVerilogDeclString() == "eq #(.WIDTH(" + counterWidth + "))");
+          comparators++;
+        }
+
+        // Without narrowing, constants from the source keep their type's
+        // width. Control uses 1 bit constants.
+        if (!narrow && isConstant(r) && constantValue(r) > 1) {
+          assert(r->pt("out").getWidth() == 32);
+        }
+      }
+      assert(phis == 1);
+      assert(comparators > 0);
+      assert(m->ipt("ram_raddr_0").getWidth() == 7);
+      assert(m->ipt("ram_waddr_0").getWidth() == 7);
+
+      inlineInvokes(m);
+      synthesizeDelays(m);
+      deleteNoEffectInstructions(m);
+      synthesizeChannels(m);
+      reduceStructures(m);
+      foldConstants(m);
+      deleteNoEffectInstructions(m);
+      deleteUnreachableInstructions(m);
+
+      emitVerilog(c, m);
+      assert(runIVerilogTB(m->getName()));
+    }
+  }});
+
+  tests.push_back({"read_add_2_loop_ssa_chained", []() {
+    runCmd("clang -S -emit-llvm ./c_files/read_add_2_loop_ssa.c -c -O3");
+
+    // The loop counter update and exit test chain into the cycle that
+    // reads the phi
+    LLVMLoadOptions options;
+    options.chainDelay = 8;
+
+    Context c;
+    loadLLVMFromFile(c, "read_add_2_loop_ssa", "./read_add_2_loop_ssa.ll", options);
+
+    Module* m = c.getModule("read_add_2_loop_ssa");
+    assert(m != nullptr);
+
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);
+    synthesizeChannels(m);
+    reduceStructures(m);
+    foldConstants(m);
+    deleteNoEffectInstructions(m);
+    deleteUnreachableInstructions(m);
+
+    emitVerilog(c, m);
+
+    ModuleEstimate est = estimateModule(m);
+    cout << est;
+    assert(est.flops > 0);
+    assert(est.criticalPath > 0);
+    assert(est.blackBoxes.empty());
+    assert(runIVerilogTB(m->getName()));
+  }});
+
+  tests.push_back({"alloca_round_trip_chained", []() {
+    // Loads of t chain into the additions that use them, but not ahead of
+    // the store before them
+    runCmd("clang -S -emit-llvm ./c_files/alloca_round_trip.c -c -O0");
+
+    LLVMLoadOptions options;
+    options.chainDelay = 8;
+
+    Context c;
+    loadLLVMFromFile(c, "alloca_round_trip", "./alloca_round_trip.ll", options);
+
+    Module* m = c.getModule("alloca_round_trip");
+    assert(m != nullptr);
+
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);
+    synthesizeChannels(m);
+    reduceStructures(m);
+    foldConstants(m);
+    deleteNoEffectInstructions(m);
+    deleteUnreachableInstructions(m);
+
+    emitVerilog(c, m);
+    assert(runIVerilogTB(m->getName()));
+  }});
+
+  tests.push_back({"profiled_loop", []() {
+    runCmd("clang -S -emit-llvm ./c_files/profiled_loop.c -c -O3");
+
+    Context c;
+    loadLLVMFromFile(c, "profiled_loop", "./profiled_loop.ll");
+
+    Module* m = c.getModule("profiled_loop");
+    assert(m != nullptr);
+
+    inlineInvokes(m);
+    synthesizeDelays(m);
+    deleteNoEffectInstructions(m);
+    synthesizeChannels(m);
+    reduceStructures(m);
+    foldConstants(m);
+    deleteNoEffectInstructions(m);
+    deleteUnreachableInstructions(m);
+
+    VerilogEmitOptions options;
+    options.profileCounters = true;
+    emitVerilog(c, m, options);
+
+    vector<string> labels = profileCounterLabels(m);
+    assert(labels[0] == "cycles");
+    assert(labels[1] == "entry");
+
+    assert(runIVerilogTB(m->getName()));
+  }});
+
+  tests.push_back({"dataflow_add", []() {
+    runCmd("clang -S -emit-llvm ./c_files/dataflow_add.c -c -O3");
+
+    Context c;
+    loadLLVMFromFile(c, "dataflow_add", "./dataflow_add.ll");
+
+    Module* m = c.getModule("dataflow_add");
+    assert(m != nullptr);
+
+    // Each stage is its own module in the hierarchy
+    for (string name : {"add_1", "times_2", "dataflow_add"}) {
+      Module* stage = c.getModule(name);
+
+      inlineInvokes(stage);
+      synthesizeDelays(stage);
+      deleteNoEffectInstructions(stage);
+      synthesizeChannels(stage);
+      reduceStructures(stage);
+      foldConstants(stage);
+      deleteNoEffectInstructions(stage);
+      deleteUnreachableInstructions(stage);
+    }
+
+    emitVerilogHierarchy(c, m);
+    assert(runIVerilogTB(m->getName()));
+  }});
+
+  // Results stay in test_scratch/qor, and the baseline is read from the
+  // repository root
+  tests.push_back({"qor", []() {
+    runQoRSuite("qor_results.txt", "../../qor_baseline.txt");
+  }});
 
   // {
   //   runCmd("clang -S -emit-llvm ./c_files/read_add_2_or_3.c -c -O3");
@@ -457,5 +1957,45 @@ int main() {
 
   // TODO:
   //  1. Set reset values of sensitive ports to their defaults
-  
+
+  return tests;
+}
+
+// Usage: [-j jobs] [test names...]. Runs every test when none are named
+int main(int argc, char** argv) {
+  if (argc > 1 && string(argv[1]) == "bench") {
+    return runCompileBenchmarks(vector<string>(argv + 2, argv + argc));
+  }
+
+  if (argc == 3 && string(argv[1]) == "--run-test") {
+    for (auto test : allTests()) {
+      if (test.name == argv[2]) {
+        runTestInScratchDir(test);
+        cout << flush;
+        return 0;
+      }
+    }
+    cout << "Error: No test named " << argv[2] << endl;
+    return 1;
+  }
+
+  int jobs = max(1, (int) thread::hardware_concurrency());
+  set<string> selected;
+  for (int i = 1; i < argc; i++) {
+    if (string(argv[i]) == "-j" && i + 1 < argc) {
+      jobs = stoi(argv[i + 1]);
+      i++;
+    } else {
+      selected.insert(argv[i]);
+    }
+  }
+
+  vector<TestCase> tests;
+  for (auto test : allTests()) {
+    if (selected.empty() || elem(test.name, selected)) {
+      tests.push_back(test);
+    }
+  }
+
+  return runTests(tests, jobs, argv[0]) ? 0 : 1;
 }
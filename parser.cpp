@@ -180,7 +180,9 @@ namespace CAC {
           break;
         }
 
+        int start = state.currentPos();
         Token t = parse_token(state);
+        t.setOffset(start);
         //cout << "Next char after token = " << state.peekChar() << endl;
         tokens.push_back(t);
       }
@@ -638,6 +640,8 @@ namespace CAC {
   }
 
   maybe<ModuleAST*> parseModule(ParseState<Token>& tokens) {
+    exit_end(tokens);
+    int sourceStart = tokens.peekChar().getOffset();
     try_consume("module", tokens);
     Token modName = tokens.parseChar();
     try_consume("(", tokens);
@@ -649,7 +653,10 @@ namespace CAC {
     auto body = many<BlockAST*, Token>(parseBlock, tokens);
     try_consume("endmodule", tokens);
 
-    return new ModuleAST(modName, ports, body);
+    auto m = new ModuleAST(modName, ports, body);
+    m->sourceStart = sourceStart;
+    m->sourceEnd = tokens.lastChar().endOffset();
+    return m;
   }
 
   void parseTokens(TLU& t, vector<Token>& tokens) {
@@ -671,6 +678,7 @@ namespace CAC {
     std::string str((std::istreambuf_iterator<char>(f)),
         std::istreambuf_iterator<char>());    
     TLU t;
+    t.source = str;
     vector<Token> tokens = tokenize(str);
     cout << "Tokens" << endl;
     for (auto t : tokens) {
@@ -896,6 +904,7 @@ namespace CAC {
       cout << "Adding label " << body->label->getName() << " to map" << endl;
       assert(!contains_key(body->label->getName(), c.labelMap));
       c.labelMap[body->label->getName()] = body;
+      fst->profileLabel = body->label->getName();
     }
 
   }
@@ -974,10 +983,54 @@ namespace CAC {
   }
 
 
+  std::set<std::string> moduleDependencies(ModuleAST* m) {
+    std::set<std::string> deps;
+    for (auto blk : m->blocks) {
+      if (ResourceAST::classof(blk)) {
+        deps.insert(sc<ResourceAST>(blk)->typeName.getStr());
+      } else if (ModuleBlockAST::classof(blk)) {
+        for (auto dep : moduleDependencies(sc<ModuleBlockAST>(blk)->m)) {
+          deps.insert(dep);
+        }
+      }
+    }
+    return deps;
+  }
+
   void lowerTLU(Context& c, TLU& t) {
+    std::set<std::string> moduleNames;
+    for (auto mAST : t.modules) {
+      moduleNames.insert(mAST->getName().getStr());
+    }
+    lowerTLU(c, t, moduleNames);
+  }
+
+  void lowerTLU(Context& c, TLU& t, const std::set<std::string>& moduleNames) {
+    std::set<std::string> toLower;
+    vector<std::string> worklist(moduleNames.begin(), moduleNames.end());
+    while (worklist.size() > 0) {
+      std::string name = worklist.back();
+      worklist.pop_back();
+      if (toLower.count(name) > 0) {
+        continue;
+      }
+      toLower.insert(name);
+
+      ModuleAST* mAST = t.getModule(name);
+      if (mAST != nullptr) {
+        for (auto dep : moduleDependencies(mAST)) {
+          worklist.push_back(dep);
+        }
+      }
+    }
+
     CodeGenState cgo;
     cgo.c = &c;
     for (auto mAST : t.modules) {
+      if (toLower.count(mAST->getName().getStr()) == 0) {
+        continue;
+      }
+
       auto m = c.addCombModule(mAST->getName().getStr());
       cgo.activeMod = m;
       for (auto pAST : mAST->ports) {
@@ -1063,4 +1116,97 @@ namespace CAC {
     }
   }
 
+  static inline
+  uint64_t fnv1a(const std::string& str, uint64_t hash) {
+    for (auto ch : str) {
+      hash ^= (unsigned char) ch;
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  std::map<std::string, uint64_t> moduleFingerprints(const TLU& t, const std::string& salt) {
+    std::map<std::string, uint64_t> fingerprints;
+    // Resources must be declared before use, so every dependency defined in
+    // this file has already been fingerprinted
+    for (auto mAST : t.modules) {
+      assert(mAST->sourceStart >= 0);
+      assert(mAST->sourceEnd >= mAST->sourceStart);
+
+      // Tokens rather than text, so whitespace and comments do not count
+      uint64_t hash = fnv1a(salt, 14695981039346656037ULL);
+      for (auto tok : tokenize(t.source.substr(mAST->sourceStart, mAST->sourceEnd - mAST->sourceStart))) {
+        hash = fnv1a(tok.getStr() + " ", hash);
+      }
+      for (auto dep : moduleDependencies(mAST)) {
+        hash = fnv1a(dep, hash);
+        if (contains_key(dep, fingerprints)) {
+          hash = fnv1a(to_string(map_find(dep, fingerprints)), hash);
+        }
+      }
+      fingerprints[mAST->getName().getStr()] = hash;
+    }
+    return fingerprints;
+  }
+
+  std::map<std::string, uint64_t> loadFingerprints(const std::string& path) {
+    std::map<std::string, uint64_t> fingerprints;
+    ifstream in(path);
+    std::string name;
+    uint64_t fingerprint;
+    while (in >> name >> fingerprint) {
+      fingerprints[name] = fingerprint;
+    }
+    return fingerprints;
+  }
+
+  void saveFingerprints(const std::string& path,
+                        const std::map<std::string, uint64_t>& fingerprints) {
+    ofstream out(path);
+    for (auto& f : fingerprints) {
+      out << f.first << " " << f.second << endl;
+    }
+  }
+
+  std::set<std::string>
+  compileIncremental(const std::string& sourcePath,
+                     const std::string& fingerprintPath,
+                     const std::string& salt,
+                     std::function<void(Context&, Module*)> compileModule) {
+    TLU t = parseTLU(sourcePath);
+    auto fingerprints = moduleFingerprints(t, salt);
+    auto previous = loadFingerprints(fingerprintPath);
+
+    std::set<std::string> changed;
+    for (auto& f : fingerprints) {
+      if (!contains_key(f.first, previous) ||
+          map_find(f.first, previous) != f.second) {
+        changed.insert(f.first);
+      }
+    }
+
+    cout << changed.size() << " of " << fingerprints.size() << " modules changed in " << sourcePath << endl;
+
+    Context c;
+    lowerTLU(c, t, changed);
+
+    std::set<std::string> recompiled;
+    for (auto mAST : t.modules) {
+      std::string name = mAST->getName().getStr();
+      if (changed.count(name) == 0) {
+        continue;
+      }
+
+      Module* m = c.getModule(name);
+      if (m->isPrimitiveModule()) {
+        continue;
+      }
+      compileModule(c, m);
+      recompiled.insert(name);
+    }
+
+    saveFingerprints(fingerprintPath, fingerprints);
+    return recompiled;
+  }
+
 }
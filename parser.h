@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <sstream>
 
 #include "ir.h"
@@ -25,12 +27,13 @@ namespace CAC {
   class Token {
     std::string str;
     TokenType tp;
+    int offset;
   
   public:
 
-    Token() {}
+    Token() : offset(-1) {}
   
-    Token(const std::string& str_) : str(str_), tp(TOKEN_TYPE_ID) {
+    Token(const std::string& str_) : str(str_), tp(TOKEN_TYPE_ID), offset(-1) {
       if (isKeyword(str)) {
         tp = TOKEN_TYPE_KEYWORD;
       }
@@ -40,9 +43,14 @@ namespace CAC {
       }
     }
     Token(const std::string& str_,
-          const TokenType tp_) : str(str_), tp(tp_) {}
+          const TokenType tp_) : str(str_), tp(tp_), offset(-1) {}
 
     TokenType type() const { return tp; }
+
+    // Byte offset of the token in its source file, -1 if unknown
+    int getOffset() const { return offset; }
+    void setOffset(const int offset_) { offset = offset_; }
+    int endOffset() const { return offset + (int) str.size(); }
   
     bool isId() const { return type() == TOKEN_TYPE_ID; }
     bool isNum() const { return type() == TOKEN_TYPE_NUM; }
@@ -332,10 +340,13 @@ namespace CAC {
   public:
     vector<PortAST*> ports;
     vector<BlockAST*> blocks;
+    // Source byte range [sourceStart, sourceEnd) of the module text
+    int sourceStart;
+    int sourceEnd;
 
     ModuleAST(Token n,
               vector<PortAST*>& pts,
-              vector<BlockAST*>& blks) : name(n), ports(pts), blocks(blks) {}
+              vector<BlockAST*>& blks) : name(n), ports(pts), blocks(blks), sourceStart(-1), sourceEnd(-1) {}
 
     Token getName() const { return name; }
   };
@@ -370,6 +381,11 @@ namespace CAC {
   
     T peekChar() const { return peekChar(0); }
 
+    T lastChar() const {
+      assert(pos > 0);
+      return ts[pos - 1];
+    }
+
     T parseChar() {
       assert(((int) ts.size()) > pos);
 
@@ -401,7 +417,17 @@ namespace CAC {
 
   class TranslationUnit {
   public:
+    std::string source;
     vector<ModuleAST*> modules;
+
+    ModuleAST* getModule(const std::string& name) const {
+      for (auto m : modules) {
+        if (m->getName().getStr() == name) {
+          return m;
+        }
+      }
+      return nullptr;
+    }
   };
 
   typedef TranslationUnit TLU;
@@ -471,4 +497,31 @@ namespace CAC {
   TLU parseTLU(const std::string& str);
 
   void lowerTLU(Context& c, TLU& t);
+
+  // Lowers only the named top level modules and the modules they
+  // instantiate, in source order
+  void lowerTLU(Context& c, TLU& t, const std::set<std::string>& moduleNames);
+
+  std::set<std::string> moduleDependencies(ModuleAST* m);
+
+  // Fingerprint of each top level module's tokens combined with the
+  // fingerprints of every module it instantiates. salt is mixed into every
+  // fingerprint, so a change to it invalidates them all.
+  std::map<std::string, uint64_t> moduleFingerprints(const TLU& t, const std::string& salt);
+
+  std::map<std::string, uint64_t> loadFingerprints(const std::string& path);
+
+  void saveFingerprints(const std::string& path,
+                        const std::map<std::string, uint64_t>& fingerprints);
+
+  // Parses sourcePath and runs compileModule (passes + emission) only on
+  // the non-external modules whose fingerprint differs from the one saved
+  // in fingerprintPath. salt should name everything besides the source
+  // that the output depends on, such as the tool version and the passes
+  // compileModule runs. Returns the names of the recompiled modules.
+  std::set<std::string>
+  compileIncremental(const std::string& sourcePath,
+                     const std::string& fingerprintPath,
+                     const std::string& salt,
+                     std::function<void(Context&, Module*)> compileModule);
 }
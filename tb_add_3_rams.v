@@ -0,0 +1,147 @@
+`define assert(signal, value) if ((signal) !== (value)) begin $display("ASSERTION FAILED in %m: signal != value"); $finish(1); end
+
+module test();
+
+   reg clk;
+   reg rst;
+   reg start;
+   wire done;
+   wire ready;
+
+   reg  debug_write_en;
+   reg [31:0] debug_write_data;
+   reg [31:0] debug_write_addr;
+
+   wire [31:0] a_debug_read_data;
+   wire [31:0] b_debug_read_data;
+   wire [31:0] c_debug_read_data;
+   reg [31:0] debug_read_addr;
+
+   integer     i;
+   
+   initial begin
+      #1 debug_write_en = 1;
+      #1 clk = 0;
+      #1 rst = 0;
+      #1 start = 0;
+
+      // a[i] = b[i] = 10*i + 3
+      for (i = 0; i < 2; i = i + 1) begin
+         #1 debug_write_addr = i;
+         #1 debug_write_data = 10*i + 3;
+         
+         #1 clk = 0;
+         #1 clk = 1;
+         #1 clk = 0;
+      end
+
+      #1 debug_write_en = 0;
+
+      #1 rst = 1;
+
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      `assert(ready, 1'b1)
+      `assert(done, 1'b0)
+
+      #1 rst = 0;
+
+      #1 start = 1;
+      
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      #1 start = 0;
+
+      `assert(ready, 1'b0)
+
+      i = 0;
+      while (!done && i < 100) begin
+         #1 clk = 0;
+         #1 clk = 1;
+         #1 clk = 0;
+         i = i + 1;
+      end
+
+      // Let the last write land
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      #1 debug_read_addr = 0;
+      #1 $display("c[0]         = %d", c_debug_read_data);
+      `assert(c_debug_read_data, 6)
+
+      #1 debug_read_addr = 1;
+      #1 $display("c[1]         = %d", c_debug_read_data);
+      `assert(c_debug_read_data, 26)
+
+      `assert(done, 1'b1)
+      `assert(ready, 1'b1)
+
+      $display("Passed");
+      
+   end // initial begin
+
+   RAM a(.clk(clk),
+         .rst(rst),
+
+         .debug_data(a_debug_read_data),
+         .debug_addr(debug_read_addr),           
+
+         .debug_write_data(debug_write_data),
+         .debug_write_en(debug_write_en),
+         .debug_write_addr(debug_write_addr));
+
+   RAM b(.clk(clk),
+         .rst(rst),
+
+         .debug_data(b_debug_read_data),
+         .debug_addr(debug_read_addr),           
+
+         .debug_write_data(debug_write_data),
+         .debug_write_en(debug_write_en),
+         .debug_write_addr(debug_write_addr));
+
+   RAM c(.clk(clk),
+         .rst(rst),
+
+         .debug_data(c_debug_read_data),
+         .debug_addr(debug_read_addr),           
+
+         .debug_write_data(32'd0),
+         .debug_write_en(1'b0),
+         .debug_write_addr(32'd0));
+
+   add_3_rams dut(.clk(clk),
+                  .rst(rst),
+                  .ready(ready),
+                  .start(start),
+                  .done(done),
+
+                  .a_raddr_0(a.raddr_0),
+                  .a_rdata_0(a.rdata_0),
+                  .a_waddr_0(a.waddr_0),
+                  .a_wen_0(a.wen_0),
+                  .a_wdata_0(a.wdata_0),
+
+                  .b_raddr_0(b.raddr_0),
+                  .b_rdata_0(b.rdata_0),
+                  .b_waddr_0(b.waddr_0),
+                  .b_wen_0(b.wen_0),
+                  .b_wdata_0(b.wdata_0),
+
+                  .c_raddr_0(c.raddr_0),
+                  .c_rdata_0(c.rdata_0),
+                  .c_waddr_0(c.waddr_0),
+                  .c_wen_0(c.wen_0),
+                  .c_wdata_0(c.wdata_0));
+   
+endmodule
@@ -0,0 +1,175 @@
+`define assert(signal, value) if ((signal) !== (value)) begin $display("ASSERTION FAILED in %m: signal != value"); $finish(1); end
+
+module test();
+
+   reg clk;
+   reg rst;
+   reg start;
+   wire done;
+   wire ready;
+
+   wire        m_axi_arvalid;
+   wire        m_axi_arready;
+   wire [31:0] m_axi_araddr;
+   wire [7:0]  m_axi_arlen;
+   wire        m_axi_rvalid;
+   wire        m_axi_rready;
+   wire [31:0] m_axi_rdata;
+   wire [1:0]  m_axi_rresp;
+   wire        m_axi_rlast;
+
+   wire        m_axi_awvalid;
+   wire        m_axi_awready;
+   wire [31:0] m_axi_awaddr;
+   wire [7:0]  m_axi_awlen;
+   wire        m_axi_wvalid;
+   wire        m_axi_wready;
+   wire [31:0] m_axi_wdata;
+   wire        m_axi_wlast;
+   wire        m_axi_bvalid;
+   wire [1:0]  m_axi_bresp;
+
+   integer     i;
+
+   // Memory behind the bus
+   reg [31:0]  mem [0:31];
+
+   // Reads return one beat per cycle once the address is accepted
+   reg         reading;
+   reg [31:0]  read_word;
+   reg [7:0]   read_left;
+
+   assign m_axi_arready = !reading;
+   assign m_axi_rvalid = reading;
+   assign m_axi_rdata = mem[read_word];
+   assign m_axi_rresp = 2'b00;
+   assign m_axi_rlast = read_left == 0;
+
+   always @(posedge clk) begin
+      if (rst) begin
+         reading <= 0;
+      end else if (m_axi_arvalid && m_axi_arready) begin
+         reading <= 1;
+         read_word <= m_axi_araddr >> 2;
+         read_left <= m_axi_arlen;
+      end else if (reading && m_axi_rready) begin
+         read_word <= read_word + 1;
+         read_left <= read_left - 1;
+         if (read_left == 0) begin
+            reading <= 0;
+         end
+      end
+   end
+
+   // Writes take data once the address is accepted and respond after the
+   // last beat
+   reg         aw_taken;
+   reg [31:0]  write_word;
+   reg         bvalid;
+
+   assign m_axi_awready = !aw_taken;
+   assign m_axi_wready = aw_taken;
+   assign m_axi_bvalid = bvalid;
+   assign m_axi_bresp = 2'b00;
+
+   always @(posedge clk) begin
+      if (rst) begin
+         aw_taken <= 0;
+         bvalid <= 0;
+      end else begin
+         bvalid <= 0;
+
+         if (m_axi_awvalid && m_axi_awready) begin
+            aw_taken <= 1;
+            write_word <= m_axi_awaddr >> 2;
+         end
+
+         if (m_axi_wvalid && m_axi_wready) begin
+            mem[write_word] <= m_axi_wdata;
+            write_word <= write_word + 1;
+
+            if (m_axi_wlast) begin
+               aw_taken <= 0;
+               bvalid <= 1;
+            end
+         end
+      end
+   end
+
+   initial begin
+      // mem[i] = 10*i + 3
+      for (i = 0; i < 8; i = i + 1) begin
+         mem[i] = 10*i + 3;
+      end
+
+      #1 clk = 0;
+      #1 rst = 1;
+      #1 start = 0;
+
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      `assert(ready, 1'b1)
+      `assert(done, 1'b0)
+
+      #1 rst = 0;
+
+      #1 start = 1;
+
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      #1 start = 0;
+
+      `assert(ready, 1'b0)
+
+      i = 0;
+      while (!done && i < 200) begin
+         #1 clk = 0;
+         #1 clk = 1;
+         #1 clk = 0;
+         i = i + 1;
+      end
+
+      `assert(done, 1'b1)
+      `assert(ready, 1'b1)
+
+      for (i = 0; i < 8; i = i + 1) begin
+         #1 $display("mem[%d] = %d", i + 8, mem[i + 8]);
+         `assert(mem[i + 8], 10*i + 5)
+      end
+
+      $display("Passed");
+
+   end // initial begin
+
+   axi_add_2 dut(.clk(clk),
+                 .rst(rst),
+                 .ready(ready),
+                 .start(start),
+                 .done(done),
+
+                 .ddr_m_axi_arvalid(m_axi_arvalid),
+                 .ddr_m_axi_arready(m_axi_arready),
+                 .ddr_m_axi_araddr(m_axi_araddr),
+                 .ddr_m_axi_arlen(m_axi_arlen),
+                 .ddr_m_axi_rvalid(m_axi_rvalid),
+                 .ddr_m_axi_rready(m_axi_rready),
+                 .ddr_m_axi_rdata(m_axi_rdata),
+                 .ddr_m_axi_rresp(m_axi_rresp),
+                 .ddr_m_axi_rlast(m_axi_rlast),
+
+                 .ddr_m_axi_awvalid(m_axi_awvalid),
+                 .ddr_m_axi_awready(m_axi_awready),
+                 .ddr_m_axi_awaddr(m_axi_awaddr),
+                 .ddr_m_axi_awlen(m_axi_awlen),
+                 .ddr_m_axi_wvalid(m_axi_wvalid),
+                 .ddr_m_axi_wready(m_axi_wready),
+                 .ddr_m_axi_wdata(m_axi_wdata),
+                 .ddr_m_axi_wlast(m_axi_wlast),
+                 .ddr_m_axi_bvalid(m_axi_bvalid),
+                 .ddr_m_axi_bresp(m_axi_bresp));
+
+endmodule
@@ -0,0 +1,128 @@
+`define assert(signal, value) if ((signal) !== (value)) begin $display("ASSERTION FAILED in %m: signal != value"); $finish(1); end
+
+module test();
+
+   reg clk;
+   reg rst;
+   reg start;
+   wire done;
+   wire ready;
+
+   reg  debug_write_en;
+   reg [31:0] debug_write_data;
+   reg [31:0] debug_write_addr;
+
+   wire [31:0] debug_read_data;
+   reg [31:0] debug_read_addr;
+
+   // What the kernel should leave in memory
+   reg [31:0] expected [0:15];
+
+   integer     i;
+   integer     cycles;
+
+   initial begin
+      for (i = 0; i < 16; i = i + 1) begin
+         expected[i] = 100 + i;
+      end
+
+      expected[0] = 10;
+      expected[1] = 20;
+      expected[2] = 30;
+      expected[3] = 40;
+
+      #1 debug_write_en = 1;
+      #1 clk = 0;
+      #1 rst = 0;
+      #1 start = 0;
+
+      for (i = 0; i < 16; i = i + 1) begin
+         #1 debug_write_addr = i;
+         #1 debug_write_data = expected[i];
+
+         #1 clk = 0;
+         #1 clk = 1;
+         #1 clk = 0;
+      end
+
+      #1 debug_write_en = 0;
+
+      // The read of 4 sees the write to 4, not the 104 that was there
+      expected[4] = 11;
+      expected[5] = 31;
+      expected[6] = 70;
+
+      #1 rst = 1;
+
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      `assert(ready, 1'b1)
+      `assert(done, 1'b0)
+
+      #1 rst = 0;
+
+      #1 start = 1;
+
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      #1 start = 0;
+
+      `assert(ready, 1'b0)
+
+      cycles = 1;
+      while (!done && cycles < 500) begin
+         #1 clk = 0;
+         #1 clk = 1;
+         #1 clk = 0;
+         cycles = cycles + 1;
+      end
+
+      // Let the last write land
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      `assert(done, 1'b1)
+      `assert(ready, 1'b1)
+
+      for (i = 0; i < 16; i = i + 1) begin
+         #1 debug_read_addr = i;
+         #1 if (debug_read_data !== expected[i]) begin
+            $display("ram[%0d] = %0d, expected %0d", i, debug_read_data, expected[i]);
+         end
+         `assert(debug_read_data, expected[i])
+      end
+
+      $display("cycles = %0d", cycles);
+      $display("Passed");
+
+   end // initial begin
+
+   RAM #(.DEPTH(128)) ram(.clk(clk),
+                          .rst(rst),
+
+                          .debug_data(debug_read_data),
+                          .debug_addr(debug_read_addr),
+
+                          .debug_write_data(debug_write_data),
+                          .debug_write_en(debug_write_en),
+                          .debug_write_addr(debug_write_addr));
+
+   posted_writes dut(.clk(clk),
+                     .rst(rst),
+                     .ready(ready),
+                     .start(start),
+                     .done(done),
+
+                     .ram_raddr_0(ram.raddr_0),
+                     .ram_rdata_0(ram.rdata_0),
+
+                     .ram_waddr_0(ram.waddr_0),
+                     .ram_wen_0(ram.wen_0),
+                     .ram_wdata_0(ram.wdata_0));
+
+endmodule
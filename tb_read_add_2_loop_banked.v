@@ -0,0 +1,139 @@
+`define assert(signal, value) if ((signal) !== (value)) begin $display("ASSERTION FAILED in %m: signal != value"); $finish(1); end
+
+module test();
+
+   reg clk;
+   reg rst;
+   reg start;
+   wire done;
+   wire ready;
+
+   reg  debug_write_en;
+   reg [31:0] debug_write_data;
+   reg [31:0] debug_write_addr;
+
+   wire [31:0] debug_read_data;
+   reg [31:0] debug_read_addr;
+
+   // Word i lives at address i / 2 of bank i % 2
+   wire [31:0] bank0_debug_read_data;
+   wire [31:0] bank1_debug_read_data;
+   assign debug_read_data = debug_read_addr[0] ? bank1_debug_read_data : bank0_debug_read_data;
+
+   integer     i;
+   
+   initial begin
+      #1 debug_write_en = 1;
+      #1 clk = 0;
+      #1 rst = 0;
+      #1 start = 0;
+
+      for (i = 0; i < 4; i = i + 1) begin
+         #1 debug_write_addr = i;
+         #1 debug_write_data = 10*i;
+         
+         #1 clk = 0;
+         #1 clk = 1;
+         #1 clk = 0;
+      end
+
+      // Trip count
+      #1 debug_write_addr = 15;
+      #1 debug_write_data = 4;
+      
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      #1 debug_write_en = 0;
+      #1 debug_read_addr = 7;
+
+      #1 rst = 1;
+
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      `assert(ready, 1'b1)
+      `assert(done, 1'b0)
+
+      #1 rst = 0;
+
+      #1 start = 1;
+      
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      #1 start = 0;
+
+      `assert(ready, 1'b0)
+
+      // The loop runs for a data dependent number of cycles
+      i = 0;
+      while (!done && i < 500) begin
+         #1 clk = 0;
+         #1 clk = 1;
+         #1 clk = 0;
+         i = i + 1;
+      end
+
+      // Let the last write land
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+      
+      $display("Cycles       = %d", i);
+      $display("ram[7]       = %d", debug_read_data);
+
+      `assert(done, 1'b1)
+      `assert(ready, 1'b1)
+      `assert(debug_read_data, 32)
+
+      $display("Passed");
+      
+   end // initial begin
+
+   RAM bank0(.clk(clk),
+             .rst(rst),
+
+             .debug_data(bank0_debug_read_data),
+             .debug_addr(debug_read_addr >> 1),
+
+             .debug_write_data(debug_write_data),
+             .debug_write_en(debug_write_en && !debug_write_addr[0]),
+             .debug_write_addr(debug_write_addr >> 1));
+
+   RAM bank1(.clk(clk),
+             .rst(rst),
+
+             .debug_data(bank1_debug_read_data),
+             .debug_addr(debug_read_addr >> 1),
+
+             .debug_write_data(debug_write_data),
+             .debug_write_en(debug_write_en && debug_write_addr[0]),
+             .debug_write_addr(debug_write_addr >> 1));
+
+   read_add_2_loop_banked dut(.clk(clk),
+                              .rst(rst),
+                              .ready(ready),
+                              .start(start),
+                              .done(done),
+
+                              .ram_bank0_raddr_0(bank0.raddr_0),
+                              .ram_bank0_rdata_0(bank0.rdata_0),
+                              .ram_bank0_waddr_0(bank0.waddr_0),
+                              .ram_bank0_wen_0(bank0.wen_0),
+                              .ram_bank0_wdata_0(bank0.wdata_0),
+
+                              .ram_bank1_raddr_0(bank1.raddr_0),
+                              .ram_bank1_rdata_0(bank1.rdata_0),
+                              .ram_bank1_waddr_0(bank1.waddr_0),
+                              .ram_bank1_wen_0(bank1.wen_0),
+                              .ram_bank1_wdata_0(bank1.wdata_0));
+   
+endmodule
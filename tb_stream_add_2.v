@@ -0,0 +1,144 @@
+`define assert(signal, value) if ((signal) !== (value)) begin $display("ASSERTION FAILED in %m: signal != value"); $finish(1); end
+
+module test();
+
+   reg clk;
+   reg rst;
+   reg start;
+   wire done;
+   wire ready;
+
+   reg  in_push;
+   reg [31:0] in_push_data;
+   wire       in_not_full;
+
+   wire       in_read_valid;
+   wire       in_read_ready;
+   wire [31:0] in_out_data;
+
+   reg         out_pop;
+   wire        out_not_empty;
+   wire [31:0] out_pop_data;
+
+   wire        out_write_valid;
+   wire        out_write_ready;
+   wire [31:0] out_in_data;
+
+   integer     i;
+
+   initial begin
+      #1 clk = 0;
+      #1 rst = 1;
+      #1 start = 0;
+      #1 in_push = 0;
+      #1 out_pop = 0;
+
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      `assert(ready, 1'b1)
+      `assert(done, 1'b0)
+
+      #1 rst = 0;
+
+      // Element count followed by in[i] = 10*i + 3
+      #1 in_push = 1;
+      #1 in_push_data = 5;
+
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      for (i = 0; i < 5; i = i + 1) begin
+         #1 in_push_data = 10*i + 3;
+
+         #1 clk = 0;
+         #1 clk = 1;
+         #1 clk = 0;
+      end
+
+      #1 in_push = 0;
+
+      #1 start = 1;
+
+      #1 clk = 0;
+      #1 clk = 1;
+      #1 clk = 0;
+
+      #1 start = 0;
+
+      `assert(ready, 1'b0)
+
+      i = 0;
+      while (!done && i < 200) begin
+         #1 clk = 0;
+         #1 clk = 1;
+         #1 clk = 0;
+         i = i + 1;
+      end
+
+      `assert(done, 1'b1)
+      `assert(ready, 1'b1)
+      `assert(in_read_ready, 1'b0)
+
+      for (i = 0; i < 5; i = i + 1) begin
+         `assert(out_not_empty, 1'b1)
+
+         #1 out_pop = 1;
+
+         #1 clk = 0;
+         #1 clk = 1;
+         #1 clk = 0;
+
+         #1 out_pop = 0;
+
+         #1 $display("out[%d]     = %d", i, out_pop_data);
+         `assert(out_pop_data, 10*i + 5)
+      end
+
+      `assert(out_not_empty, 1'b0)
+
+      $display("Passed");
+
+   end // initial begin
+
+   fifo in_fifo(.clk(clk),
+                .rst(rst),
+
+                .read_valid(in_read_valid),
+                .read_ready(in_read_ready),
+
+                .write_valid(in_push),
+                .write_ready(in_not_full),
+
+                .in_data(in_push_data),
+                .out_data(in_out_data));
+
+   fifo out_fifo(.clk(clk),
+                 .rst(rst),
+
+                 .read_valid(out_pop),
+                 .read_ready(out_not_empty),
+
+                 .write_valid(out_write_valid),
+                 .write_ready(out_write_ready),
+
+                 .in_data(out_in_data),
+                 .out_data(out_pop_data));
+
+   stream_add_2 dut(.clk(clk),
+                    .rst(rst),
+                    .ready(ready),
+                    .start(start),
+                    .done(done),
+
+                    .in_read_valid(in_read_valid),
+                    .in_read_ready(in_read_ready),
+                    .in_out_data(in_out_data),
+
+                    .out_write_valid(out_write_valid),
+                    .out_write_ready(out_write_ready),
+                    .out_in_data(out_in_data));
+
+endmodule